@@ -0,0 +1,328 @@
+/*
+    Allocation counting benchmark of example grammars
+
+    $ g++ -O2 -std=c++14 -I.. -I../formula_compiler alloc.cpp ../formula_compiler/parser.cpp \
+        ../formula_compiler/code_gen.cpp ../formula_compiler/code_opt.cpp ../formula_compiler/code_lib.cpp \
+        -pthread -o alloc
+    $ ./alloc [iterations]
+
+    Global operator new/delete are replaced to count allocations and bytes by phase:
+    grammar construction, parsing, callbacks and teardown.
+    Grammars of calc.cpp, cmd.cpp, cfg.cpp and ini.cpp examples are replicated here,
+    the formula parser (bnflite_byte_code) builds its shared grammar in the first call
+    and generates byte-code in callbacks, so it is measured as a whole (parse phase).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <iostream>
+#include "bnflite.h"
+#include "byte_code.h"
+
+using namespace bnf;
+
+enum Phase { pBuild, pParse, pCallback, pTeardown, pOther, nPhases };
+static const char* phaseName[nPhases] = { "build", "parse", "callback", "teardown", "other" };
+static Phase phase = pOther;
+static unsigned long long allocs[nPhases];
+static unsigned long long bytes[nPhases];
+static int failed;
+
+void* operator new(size_t size)
+{
+    allocs[phase]++;
+    bytes[phase] += size;
+    void* ptr = malloc(size? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) throw() { free(ptr); }
+void operator delete[](void* ptr) throw() { free(ptr); }
+void operator delete(void* ptr, size_t) throw() { free(ptr); }
+void operator delete[](void* ptr, size_t) throw() { free(ptr); }
+
+struct InCallback // switch to callback phase while user code runs
+{
+    Phase save;
+    InCallback(): save(phase) { phase = pCallback; }
+    ~InCallback() { phase = save; }
+};
+
+static void report(const char* grammar, int iterations)
+{
+    printf("%-8s", grammar);
+    for (int i = 0; i < pOther; i++) {
+        int per = i == pParse || i == pCallback? iterations : 1;
+        printf(" %10.1f %12.1f", (double)allocs[i] / per, (double)bytes[i] / per);
+        allocs[i] = bytes[i] = 0;
+    }
+    printf(failed? "  (%d failed)\n" : "\n", failed);
+    failed = 0;
+}
+
+/* calc.cpp */
+typedef Interface<double> Calc;
+static Calc DoBracket(std::vector<Calc>& res)
+{   InCallback cb; return *res[0].text == '('? res[1] : res[0]; }
+static Calc DoNumber(std::vector<Calc>& res)
+{   InCallback cb; return Calc(strtod(res[0].text, 0), res); }
+static Calc DoUnary(std::vector<Calc>& res)
+{   InCallback cb; return *res[0].text == '-'? Calc(-res[1].data, res) : Calc(res.back().data, res); }
+static Calc DoBinary(std::vector<Calc>& res)
+{
+    InCallback cb;
+    double value = res[0].data;
+    for (unsigned int i = 1; i + 1 < res.size(); i += 2) {
+        switch (*res[i].text) {
+            case '+': value += res[i + 1].data; break;
+            case '-': value -= res[i + 1].data; break;
+            case '*': value *= res[i + 1].data; break;
+            case '/': value /= res[i + 1].data; break; }
+    }
+    return Calc(value, res);
+}
+
+struct CalcGrammar
+{
+    Token digit1_9, DIGIT;
+    Lexem I_DIGIT, frac, int_, exp;
+    Rule number, Expression, PrimaryExpression, UnaryExpression, MulExpression, AddExpression;
+    CalcGrammar(): digit1_9('1', '9'), DIGIT("0123456789")
+    {
+        I_DIGIT = 1*DIGIT;
+        frac = "." + I_DIGIT;
+        int_ = "0" | digit1_9 + *DIGIT;
+        exp = "Ee" + !Token("+-") + I_DIGIT;
+        number = !Token("-") + int_ + !frac + !exp;
+        Bind(number, DoNumber);
+        Bind(Expression, Calc::ByPass);
+        PrimaryExpression = "(" + Expression + ")" | number;
+        Bind(PrimaryExpression, DoBracket);
+        UnaryExpression = !Token("+-") + PrimaryExpression;
+        Bind(UnaryExpression, DoUnary);
+        MulExpression = UnaryExpression + *("*%/" + UnaryExpression);
+        Bind(MulExpression, DoBinary);
+        AddExpression = MulExpression + *("+-" + MulExpression);
+        Bind(AddExpression, DoBinary);
+        Expression = AddExpression;
+    }
+    ~CalcGrammar() { Expression = Null(); }
+};
+
+static void calc(int iterations)
+{
+    phase = pBuild;
+    CalcGrammar* g = new CalcGrammar;
+    phase = pParse;
+    for (int i = 0; i < iterations; i++) {
+        Calc result;
+        if (!(Analyze(g->Expression, "2+(1+3)*2-4/2*(5.5e1+-3)", 0, result) & eOk))
+            failed++;
+    }
+    phase = pTeardown;
+    delete g;
+    phase = pOther;
+    report("calc", iterations);
+}
+
+/* cmd.cpp */
+static bool filter(const char* lexem, size_t len)
+{   InCallback cb; return len > 0; }
+
+struct CmdGrammar
+{
+    Token Alphanumeric, SequenceOfChars;
+    Lexem NAME, LINKLABEL, LINKLABELS0, FILTER_ARGUMENTS, FILTER;
+    Rule Filter, FILTERCHAIN;
+    CmdGrammar(): Alphanumeric('_'), SequenceOfChars(' ' + 1, 0x7F - 1)
+    {
+        Alphanumeric.Add('0', '9'); Alphanumeric.Add('a', 'z'); Alphanumeric.Add('A', 'Z');
+        NAME = Series(1, Alphanumeric);
+        LINKLABEL = "[" + NAME + "]";
+        LINKLABELS0 = Iterate(0, LINKLABEL);
+        SequenceOfChars.Remove("=,");
+        FILTER_ARGUMENTS = Series(1, SequenceOfChars);
+        FILTER = LINKLABELS0 + NAME + Iterate(0, "=" + FILTER_ARGUMENTS) + LINKLABELS0;
+        Filter = FILTER + filter;
+        FILTERCHAIN = Filter + Repeat(0, "," + Filter);
+    }
+};
+
+static void cmd(int iterations)
+{
+    phase = pBuild;
+    CmdGrammar* g = new CmdGrammar;
+    phase = pParse;
+    for (int i = 0; i < iterations; i++) {
+        if (!(Analyze(g->FILTERCHAIN, "[0]amerge=0=5, c1, [in]scale=320:240[out]") & eOk))
+            failed++;
+    }
+    phase = pTeardown;
+    delete g;
+    phase = pOther;
+    report("cmd", iterations);
+}
+
+/* cfg.cpp */
+static const char* xml =
+    "<client key=\"xxx\" mail=\"asa@asda.com\">"
+    "<alert type=\"memory\" limit=\"50%\" />"
+    "<alert type=\"cpu\" limit=\"20%\" />"
+    "<alert type=\"processes\" limit=\"50\" />"
+    "</client>";
+static std::string tmpstr;
+static std::vector<std::pair<std::string, std::string> > props;
+static bool addvalue(const char* lexem, size_t len)
+{   InCallback cb; tmpstr = std::string(lexem + 1, len - 2); return true; }
+static bool addlimit(const char* lexem, size_t len)
+{   InCallback cb; props.push_back(std::make_pair(tmpstr, std::string(lexem + 1, len - 2))); return true; }
+
+struct CfgGrammar
+{
+    Token value;
+    Lexem client, key, type, alert, limit, mail, quotedvalue, _client, _end;
+    Rule xclient, xalert, root;
+    CfgGrammar(): value(1, 255), client("client"), key("key"), type("type"), alert("alert"),
+        limit("limit"), mail("mail")
+    {
+        value.Remove("\"");
+        quotedvalue = "\"" + *value + "\"";
+        _client = Token("<") + Token("/") + client + ">";
+        _end = Token("/") + ">";
+        xclient = Token("<") + client + key + "=" + quotedvalue + addvalue
+            + mail + "=" + quotedvalue + addvalue + ">";
+        xalert = Token("<") + alert + type + "=" + quotedvalue + addvalue
+            + limit + "=" + quotedvalue + addlimit + _end;
+        root = *(xclient + *(xalert) + _client);
+    }
+};
+
+static void cfg(int iterations)
+{
+    phase = pBuild;
+    CfgGrammar* g = new CfgGrammar;
+    phase = pParse;
+    for (int i = 0; i < iterations; i++) {
+        if (!(Analyze(g->root, xml) & eOk))
+            failed++;
+        InCallback cb;
+        props.clear();
+    }
+    phase = pTeardown;
+    delete g;
+    phase = pOther;
+    report("cfg", iterations);
+}
+
+/* ini.cpp */
+static const char* ini =
+    "; last modified 1 April 2001 by John Doe\n"
+    " [ owner ]\n"
+    "name=John Doe\n\n"
+    "organization=Acme Widgets Inc.\n"
+    "\n"
+    "[database]\n \n"
+    "; use IP address in case network name resolution is not working\n"
+    "server=192.0.2.62   \n"
+    "port= 143\n"
+    "file=\"payroll.dat\"\n";
+typedef Interface<> Ini;
+static std::vector<std::pair<std::string, std::string> > values;
+static Ini DoSection(std::vector<Ini>& res)
+{   InCallback cb; values.push_back(std::make_pair(std::string(res[1].text, res[1].length), "")); return Ini(res.front(), res.back()); }
+static Ini DoValue(std::vector<Ini>& res)
+{
+    InCallback cb;
+    if (res.size() > 2)
+        values.push_back(std::make_pair(std::string(res[0].text, res[0].length), std::string(res[2].text, res[2].length)));
+    return Ini(res.front(), res.back());
+}
+
+class IniParser: public _Parser<Ini>
+{
+public:
+    IniParser(std::vector<Ini>* res): _Parser<Ini>(res) {}
+    const char* zero_parse(const char* ptr)
+    {
+        if (*ptr == ';' || *ptr == '#')
+            while (*ptr != 0)
+                if (*ptr++ == '\n')
+                    break;
+        return ptr;
+    }
+};
+
+struct IniGrammar
+{
+    Token space, delimiter, name, value;
+    Lexem Name, Value, Equal, Left, Right, Delimiter;
+    Rule Item, Section, Inidata;
+    IniGrammar(): space(" \t"), delimiter(" \t\n\r"), name("_.,:(){}-#@&*|"), value(1, 255)
+    {
+        name.Add('0', '9'); name.Add('a', 'z'); name.Add('A', 'Z');
+        value.Remove("\n");
+        Name = 1*name;
+        Value = *value;
+        Equal = *space + "=" + *space;
+        Left = *space + "[" + *space;
+        Right = *space + "]" + *space;
+        Delimiter = *delimiter;
+        Item = Name + Equal + Value + "\n";
+        Section = Left + Name + Right + "\n";
+        Inidata = Delimiter + *(Section + Delimiter + *(Item + Delimiter));
+        Bind(Section, DoSection);
+        Bind(Item, DoValue);
+    }
+};
+
+static void ini_(int iterations)
+{
+    phase = pBuild;
+    IniGrammar* g = new IniGrammar;
+    phase = pParse;
+    for (int i = 0; i < iterations; i++) {
+        std::vector<Ini> res;
+        IniParser parser(&res);
+        if (!(Analyze(g->Inidata, ini, parser) & eOk))
+            failed++;
+        InCallback cb;
+        values.clear();
+    }
+    phase = pTeardown;
+    delete g;
+    phase = pOther;
+    report("ini", iterations);
+}
+
+/* formula_compiler/parser.cpp */
+static void formula(int iterations)
+{
+    std::cout.setstate(std::ios::failbit); // mute messages of the formula parser
+    phase = pParse;
+    for (int i = 0; i < iterations; i++) {
+        bnflite_byte_code("2+(1+3)*2-POW(2,3)*a");
+    }
+    phase = pOther;
+    std::cout.clear();
+    report("formula", iterations);
+}
+
+int main(int argc, char* argv[])
+{
+    int iterations = argc > 1? atoi(argv[1]) : 1000;
+    if (iterations <= 0)
+        iterations = 1;
+    printf("%-8s", "grammar");
+    for (int i = 0; i < pOther; i++) {
+        printf(" %10s %12s", phaseName[i], (std::string(phaseName[i]) + "_bytes").c_str());
+    }
+    printf("\n(parse and callback numbers are per Analyze call)\n");
+    calc(iterations);
+    cmd(iterations);
+    cfg(iterations);
+    ini_(iterations);
+    formula(iterations);
+    return 0;
+}
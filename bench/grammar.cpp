@@ -0,0 +1,163 @@
+/*
+    Grammar construction and teardown benchmark
+
+    $ g++ -O2 -std=c++11 -I.. grammar.cpp -o grammar
+    $ ./grammar [max size] [repetitions]
+
+    Shapes of grammars, built with sizes 10, 100, 1000, ... up to max size (4000 by default):
+    chain     - long conjunction r0 + r1 + ... + rN of named rules (_clone of temporaries, name concatenation)
+    or        - wide disjunction r0 | r1 | ... | rN of named rules
+    literals  - disjunction of N Lexem literals, each one is a conjunction of tokens
+    recursive - N mutually recursive rules rI = "x" + rI+1 | "y" cut by rI = Null() before teardown
+    shared    - N rules referring to one lexem, reassigned and cut by = Null() (usage.remove of a long list)
+    Output: microseconds to build and to destroy (median of repetitions), nanoseconds per element,
+    number of elements and bytes of names (see Footprint)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include "bnflite.h"
+
+using namespace bnf;
+
+typedef std::chrono::steady_clock Clock;
+
+static unsigned long long since(Clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+static std::string label(const char* prefix, int i)
+{
+    char buf[32];
+    sprintf(buf, "%s%d", prefix, i);
+    return buf;
+}
+
+struct Shape
+{
+    Rule root;
+    std::vector<Rule> rules;
+    std::vector<Lexem*> lexems;
+    bool cut;   // rules are recursive, they must be cut before destruction
+    Shape(int n): rules(n), cut(false)
+    {
+        for (int i = 0; i < n; i++) {
+            rules[i].setName(label("r", i).c_str()); }
+    }
+    ~Shape()
+    {
+        if (cut) {
+            for (size_t i = 0; i < rules.size(); i++) {
+                rules[i] = Null(); } }
+        root = Null();
+        for (size_t i = 0; i < lexems.size(); i++) {
+            delete lexems[i]; }
+    }
+};
+
+static Shape* chain(int n)
+{
+    Shape* g = new Shape(n);
+    Token x('x');
+    for (int i = 0; i < n; i++) {
+        g->rules[i] = x; }
+    _And all = g->rules[0] + g->rules[1];
+    for (int i = 2; i < n; i++) {
+        all + g->rules[i]; }
+    g->root = all;
+    return g;
+}
+
+static Shape* wide(int n)
+{
+    Shape* g = new Shape(n);
+    for (int i = 0; i < n; i++) {
+        g->rules[i] = Lexem(label("w", i).c_str()); }
+    _Or all = g->rules[0] | g->rules[1];
+    for (int i = 2; i < n; i++) {
+        all | g->rules[i]; }
+    g->root = all;
+    return g;
+}
+
+static Shape* literals(int n)
+{
+    Shape* g = new Shape(0);
+    for (int i = 0; i < n; i++) {
+        g->lexems.push_back(new Lexem(label("keyword", i).c_str())); }
+    _Or all = *g->lexems[0] | *g->lexems[1];
+    for (int i = 2; i < n; i++) {
+        all | *g->lexems[i]; }
+    g->root = all;
+    return g;
+}
+
+static Shape* recursive(int n)
+{
+    Shape* g = new Shape(n);
+    for (int i = 0; i < n; i++) {
+        g->rules[i] = ("x" + g->rules[(i + 1) % n]) | "y"; }
+    g->root = g->rules[0];
+    g->cut = true;
+    return g;
+}
+
+static Shape* shared(int n)
+{
+    Shape* g = new Shape(n);
+    g->lexems.push_back(new Lexem("shared"));
+    for (int i = 0; i < n; i++) {
+        g->rules[i] = Token('s'); }
+    for (int i = 0; i < n; i++) {
+        g->rules[i] = *g->lexems[0]; }
+    _Or all = g->rules[0] | g->rules[1];
+    for (int i = 2; i < n; i++) {
+        all | g->rules[i]; }
+    g->root = all;
+    g->cut = true;
+    return g;
+}
+
+static const struct { const char* name; Shape* (*build)(int n); } shapes[] = {
+    { "chain", chain }, { "or", wide }, { "literals", literals }, { "recursive", recursive }, { "shared", shared } };
+
+int main(int argc, char* argv[])
+{
+    int max = argc > 1? atoi(argv[1]) : 4000;
+    int reps = argc > 2? atoi(argv[2]) : 5;
+    if (reps <= 0)
+        reps = 1;
+    printf("%-10s %8s %10s %10s %12s %12s %8s %10s\n",
+        "shape", "size", "build_us", "destroy_us", "build_ns/el", "destroy_ns/el", "elements", "names");
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        for (int n = 10; n <= max; n = n < max && n * 10 > max? max : n * 10) {
+            std::vector<unsigned long long> build, destroy;
+            unsigned int elements = 0; size_t names = 0;
+            for (int r = 0; r < reps; r++) {
+                Clock::time_point start = Clock::now();
+                Shape* g = shapes[s].build(n);
+                build.push_back(since(start));
+                if (!r) {
+                    Footprint fp = Footprint::Inspect(g->root);
+                    for (int k = 0; k < Footprint::nKinds; k++) {
+                        elements += fp.nodes[k]; }
+                    names = fp.names; }
+                start = Clock::now();
+                delete g;
+                destroy.push_back(since(start));
+            }
+            std::sort(build.begin(), build.end());
+            std::sort(destroy.begin(), destroy.end());
+            unsigned long long b = build[reps / 2], d = destroy[reps / 2];
+            printf("%-10s %8d %10.1f %10.1f %12.1f %12.1f %8u %10lu\n", shapes[s].name, n,
+                b / 1000., d / 1000., elements? (double)b / elements : 0, elements? (double)d / elements : 0,
+                elements, (unsigned long)names);
+            if (n == max)
+                break;
+        }
+    }
+    return 0;
+}
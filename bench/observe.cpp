@@ -0,0 +1,90 @@
+/*
+    Observers of parses: production metrics and capture of an ABNF grammar
+
+    $ g++ -O2 -std=c++11 -I.. observe.cpp -o observe
+    $ ./observe [records] [capture dir]
+    $ ./replay <capture dir>/grammars <capture dir>/captures -m tree,memo
+
+    Generated lists of numbers ("12,7,...") and broken ones ("12,x") are parsed
+    with rule "list" of an ABNF grammar watched by Metrics (see bnflite_stat.h).
+    Output: text exposition of the metrics (parses, bytes, failures by status bit,
+    latency and throughput percentiles)
+    With capture dir, each 100th record is a long one over the step budget of Capture:
+    grammars/list.abnf and captures/<time>-<n>.in/.meta are written there for replay.cpp,
+    5 captures per second are allowed, and the longest records are over max_bytes.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "bnflite_abnf.h"
+#include "bnflite_stat.h"
+
+using namespace bnf;
+
+static const char* abnf =
+    "list = number *(\",\" number)\n"
+    "number = 1*DIGIT\n";
+
+static std::string record(int i, int items, bool broken)
+{
+    std::string text;
+    char buf[16];
+    for (int k = 0; k < items; k++) {
+        snprintf(buf, sizeof(buf), k? ",%d" : "%d", (i * 7 + k * 13) % 1000);
+        text += buf;
+    }
+    if (broken)
+        text += ",x";
+    return text;
+}
+
+int main(int argc, char* argv[])
+{
+    int records = argc > 1? atoi(argv[1]) : 1000;
+    std::string dir = argc > 2? argv[2] : "";
+    Grammar grammar;
+    const char* stop;
+    if (!(grammar.Load(abnf, &stop) & eOk)) {
+        fprintf(stderr, "bad grammar at: %.40s\n", stop);
+        return 1;
+    }
+    Rule* list = grammar["list"];
+
+    Metrics metrics;
+    Observe(&metrics);
+    Observe(&metrics);  // already observing, not chained twice
+    Capture* capture = 0;
+    if (dir.size()) {
+        mkdir(dir.c_str(), 0755);
+        mkdir((dir + "/grammars").c_str(), 0755);
+        mkdir((dir + "/captures").c_str(), 0755);
+        FILE* file = fopen((dir + "/grammars/list.abnf").c_str(), "w");
+        if (!file || fputs(abnf, file) < 0 || fclose(file)) {
+            fprintf(stderr, "can not write %s/grammars/list.abnf\n", dir.c_str());
+            return 1;
+        }
+        capture = new Capture((dir + "/captures").c_str(), Capture::Thresholds(0, 0, 20000), "list", 5, 64 << 10);
+        Observe(capture);
+    }
+    int failed = 0, long_ones = 0;
+    for (int i = 0; i < records; i++) {
+        bool over = capture && i % 100 == 99;
+        std::string text = record(i, over? 2000 << (i / 100 % 5) : 1 + i % 50, i % 10 == 9);
+        long_ones += over;
+        failed += Metrics::Failed(Analyze(*list, text.c_str()));
+    }
+    if (capture) {
+        printf("# %d long records: %llu captured, %llu dropped (rate, size)\n",
+            long_ones, (unsigned long long)capture->captured, (unsigned long long)capture->dropped);
+        if (capture->captured + capture->dropped != (unsigned long long)long_ones)
+            return 1;
+    }
+    Metrics::Series s = metrics.Get(*list);
+    if (s.parses != (unsigned long long)records || s.failures[0] != (unsigned long long)failed) {
+        fprintf(stderr, "%llu parses and %llu failures are observed instead of %d and %d\n",
+            s.parses, s.failures[0], records, failed);
+        return 1;
+    }
+    printf("%s", metrics.Export().c_str());
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+    Replay benchmark over captured inputs (see Capture of bnflite_stat.h)
+
+    $ g++ -O2 -std=c++11 -I.. replay.cpp -o replay
+    $ ./replay grammars/ captures/ -m tree,memo -w 2 -r 10 -c 3
+
+    grammars/<id>.abnf - ABNF grammar for each grammar id of captured inputs
+    captures/<name>.in + <name>.meta - captured inputs and their sidecars
+    -m modes: tree (plain tree walker), memo (with memoization of lexems)
+    -w warmup passes, -r measured repetitions, -c CPU to pin the process to
+    Output: one line per mode and grammar with percentiles of latency (ns) and throughput
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include "bnflite_abnf.h"
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+using namespace bnf;
+
+struct Input
+{
+    std::string text;
+    std::string root;
+};
+
+struct Corpus
+{
+    Grammar grammar;
+    std::vector<Input> inputs;
+    size_t bytes;
+    Corpus(): bytes(0) {}
+};
+
+static bool readFile(const std::string& path, std::string& data)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        return false;
+    std::ostringstream buf;
+    buf << file.rdbuf();
+    data = buf.str();
+    return true;
+}
+
+static std::string metaValue(const std::string& meta, const char* key)
+{
+    std::istringstream lines(meta);
+    for (std::string line; std::getline(lines, line); ) {
+        if (line.compare(0, strlen(key), key) == 0 && line.size() > strlen(key) && line[strlen(key)] == ' ')
+            return line.substr(strlen(key) + 1);
+    }
+    return "";
+}
+
+static bool loadCorpora(const char* gdir, const char* cdir, std::map<std::string, Corpus>& corpora)
+{
+    DIR* dir = opendir(cdir);
+    if (!dir) {
+        fprintf(stderr, "can not open %s\n", cdir);
+        return false;
+    }
+    std::vector<std::string> names;
+    for (struct dirent* ent = readdir(dir); ent; ent = readdir(dir)) {
+        size_t len = strlen(ent->d_name);
+        if (len > 5 && !strcmp(ent->d_name + len - 5, ".meta"))
+            names.push_back(std::string(ent->d_name, len - 5));
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end()); // the same order in each run
+    for (size_t i = 0; i < names.size(); i++) {
+        std::string meta, text;
+        std::string path = std::string(cdir) + "/" + names[i];
+        if (!readFile(path + ".meta", meta) || !readFile(path + ".in", text)) {
+            fprintf(stderr, "skipped %s\n", path.c_str());
+            continue;
+        }
+        std::string id = metaValue(meta, "grammar");
+        Corpus& corpus = corpora[id];
+        if (!corpus.grammar.Size()) {
+            std::string abnf; const char* stop;
+            if (!readFile(std::string(gdir) + "/" + id + ".abnf", abnf)) {
+                fprintf(stderr, "no grammar %s/%s.abnf\n", gdir, id.c_str());
+                return false;
+            }
+            if (!(corpus.grammar.Load(abnf.c_str(), &stop) & eOk)) {
+                fprintf(stderr, "bad grammar %s at: %.40s\n", id.c_str(), stop);
+                return false;
+            }
+        }
+        Input input;
+        input.text = text;
+        input.root = metaValue(meta, "root");
+        if (!corpus.grammar[input.root.c_str()])
+            input.root = id;    // grammar id names the root rule by default
+        corpus.inputs.push_back(input);
+        corpus.bytes += text.size();
+    }
+    return true;
+}
+
+static unsigned long long parseOnce(Corpus& corpus, const Input& input, const std::string& mode)
+{
+    Rule* root = corpus.grammar[input.root.c_str()];
+    Verbatim<> parser;
+    Memo memo;
+    if (mode == "memo")
+        parser.memo = &memo;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (root)
+        Analyze(*root, input.text.c_str(), parser);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    std::string modes = "tree";
+    int warmup = 1, reps = 5, cpu = -1;
+    if (argc < 3) {
+        printf("usage: %s <grammar dir> <capture dir> [-m tree,memo] [-w warmup] [-r reps] [-c cpu]\n", argv[0]);
+        return 1;
+    }
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-m")) modes = argv[i + 1];
+        else if (!strcmp(argv[i], "-w")) warmup = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-r")) reps = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-c")) cpu = atoi(argv[i + 1]);
+    }
+    if (cpu >= 0) {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set))
+            fprintf(stderr, "can not pin to CPU %d\n", cpu);
+#else
+        fprintf(stderr, "CPU pinning is not supported\n");
+#endif
+    }
+    std::map<std::string, Corpus> corpora;
+    if (!loadCorpora(argv[1], argv[2], corpora))
+        return 1;
+
+    printf("%-6s %-20s %8s %10s %10s %10s %10s %10s\n",
+        "mode", "grammar", "inputs", "bytes", "p50_ns", "p99_ns", "p999_ns", "MB/s");
+    std::istringstream list(modes);
+    for (std::string mode; std::getline(list, mode, ','); ) {
+        if (mode != "tree" && mode != "memo") {
+            fprintf(stderr, "mode %s is not available\n", mode.c_str());
+            continue;
+        }
+        for (std::map<std::string, Corpus>::iterator itr = corpora.begin(); itr != corpora.end(); ++itr) {
+            Corpus& corpus = itr->second;
+            std::vector<unsigned long long> ns;
+            unsigned long long total = 0;
+            for (int r = -warmup; r < reps; r++) {
+                for (size_t i = 0; i < corpus.inputs.size(); i++) {
+                    unsigned long long t = parseOnce(corpus, corpus.inputs[i], mode);
+                    if (r >= 0) {
+                        ns.push_back(t);
+                        total += t;
+                    }
+                }
+            }
+            if (!ns.size())
+                continue;
+            std::sort(ns.begin(), ns.end());
+            printf("%-6s %-20s %8lu %10lu %10llu %10llu %10llu %10.2f\n",
+                mode.c_str(), itr->first.c_str(), (unsigned long)corpus.inputs.size(), (unsigned long)corpus.bytes,
+                ns[ns.size() / 2], ns[ns.size() * 99 / 100], ns[ns.size() * 999 / 1000],
+                total? (double)corpus.bytes * reps * 1000 / total : 0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,327 @@
+/*
+    Streaming throughput benchmark across input delivery modes
+
+    $ g++ -O2 -std=c++11 -pthread -I.. stream.cpp -o stream
+    $ ./stream /tmp/corpus 2048 -m memory,mmap,chunked,pread -c cold,warm -k 1024
+
+    <dir>/corpus.ini and <dir>/corpus.xml of the given size in MB are generated unless they exist.
+    Each mode runs in a forked process over the same corpus:
+    memory  - the whole file is read into one buffer
+    mmap    - the file is mapped (followed by a zero page to terminate the text)
+    chunked - chunks of -k KB are read and complete records are pushed to the parser
+    pread   - a reader thread preads chunks cut at record boundaries ahead of the parser
+    cold    - pages of the file are dropped by posix_fadvise(DONTNEED) before the run
+    warm    - the file is read once before the run
+    Output: GB/s, peak RSS (MB) and CPU utilization (user + system time / wall time)
+
+    Note: cycles are limited by maxIterate/maxLexemLength, so large texts are parsed record by record
+    (one line is one record); each Analyze call stops at the end of its record.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <sstream>
+#include "bnflite.h"
+
+using namespace bnf;
+
+static unsigned long long records, failed, items;
+
+static bool onItem(const char* lexem, size_t len)
+{   items++; return true; }
+
+/* records are parsed exactly, without skipping of white space around them */
+class Exact: public _Base
+{
+public:
+    const char* zero_parse(const char* ptr)
+    {   return ptr; }
+};
+
+struct IniRecord
+{
+    Token space, name, value;
+    Lexem Name, Value, Section, Item, Comment, Blank, Record;
+    IniRecord(): space(" \t"), name("_.,:(){}-#@&*|"), value(1, 255)
+    {
+        name.Add('0', '9'); name.Add('a', 'z'); name.Add('A', 'Z');
+        value.Remove("\n");
+        Name = 1*name;
+        Value = *value;
+        Section = *space + "[" + *space + Name + *space + "]" + *space + "\n";
+        Item = Name + *space + "=" + *space + Value + "\n" + onItem;
+        Comment = Token(";#") + *value + "\n";
+        Blank = *space + "\n";
+        Record = Section | Item | Comment | Blank;
+    }
+};
+
+struct XmlRecord
+{
+    Token space, value;
+    Lexem Quoted, Client, Alert, End, Record;
+    XmlRecord(): space(" \t"), value(1, 255)
+    {
+        value.Remove("\"\n");
+        Quoted = "\"" + *value + "\"";
+        Client = *space + Lexem("<client") + 1*space + Lexem("key=") + Quoted
+            + 1*space + Lexem("mail=") + Quoted + *space + ">" + *space + "\n" + onItem;
+        Alert = *space + Lexem("<alert") + 1*space + Lexem("type=") + Quoted
+            + 1*space + Lexem("limit=") + Quoted + *space + Lexem("/>") + *space + "\n" + onItem;
+        End = *space + Lexem("</client>") + *space + "\n";
+        Record = Client | Alert | End;
+    }
+};
+
+/* parse complete records of [begin, end) (followed by a zero byte or more text) */
+static void parse(Lexem& record, const char* begin, const char* end)
+{
+    Exact parser;
+    for (const char* ptr = begin; ptr < end; records++) {
+        const char* stop = 0;
+        int stat = Analyze(record, ptr, parser);
+        parser.Get_tail(&stop);
+        if (!(stat & eOk) || stop <= ptr || stop[-1] != '\n') {
+            failed++;
+            stop = (const char*)memchr(ptr, '\n', end - ptr);
+            stop = stop? stop + 1 : end; }
+        ptr = stop;
+    }
+}
+
+static const char* lastRecord(const char* begin, const char* end)
+{
+    while (end > begin && end[-1] != '\n')
+        end--;
+    return end;
+}
+
+static bool runMemory(Lexem& record, int fd, size_t size, size_t)
+{
+    char* buf = (char*)malloc(size + 1);
+    size_t got = 0;
+    for (ssize_t len; got < size && (len = read(fd, buf + got, size - got)) > 0; )
+        got += len;
+    buf[got] = 0;
+    parse(record, buf, buf + got);
+    free(buf);
+    return got == size;
+}
+
+static bool runMmap(Lexem& record, int fd, size_t size, size_t)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t span = (size + page) / page * page;   // at least one zero byte after the text
+    char* area = (char*)mmap(0, span, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED)
+        return false;
+    if (size && mmap(area, size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(area, span);
+        return false; }
+    madvise(area, size, MADV_SEQUENTIAL);
+    parse(record, area, area + size);
+    munmap(area, span);
+    return true;
+}
+
+static bool runChunked(Lexem& record, int fd, size_t size, size_t chunk)
+{
+    char* buf = (char*)malloc(chunk + 1);
+    size_t have = 0, total = 0;
+    for (ssize_t len; (len = read(fd, buf + have, chunk - have)) > 0 || have; ) {
+        have += len > 0? len : 0;
+        total += len > 0? len : 0;
+        buf[have] = 0;
+        const char* end = len > 0? lastRecord(buf, buf + have) : buf + have;
+        if (end == buf)
+            end = buf + have;   // a record over the chunk size is cut
+        parse(record, buf, end);
+        have -= end - buf;
+        memmove(buf, end, have);
+    }
+    free(buf);
+    return total == size;
+}
+
+struct Pipe
+{
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<std::pair<char*, size_t> > full, empty;
+    bool done;
+    Pipe(): done(false) {}
+};
+
+static bool runPread(Lexem& record, int fd, size_t size, size_t chunk)
+{
+    Pipe pipe;
+    const int depth = 4;
+    for (int i = 0; i < depth; i++)
+        pipe.empty.push_back(std::make_pair((char*)malloc(chunk + 1), 0));
+    size_t total = 0;
+    std::thread reader([&]() {
+        for (off_t off = 0; (size_t)off < size; ) {
+            std::pair<char*, size_t> buf;
+            {   std::unique_lock<std::mutex> guard(pipe.lock);
+                pipe.cond.wait(guard, [&]() { return pipe.empty.size() > 0; });
+                buf = pipe.empty.front(); pipe.empty.pop_front(); }
+            ssize_t len = pread(fd, buf.first, chunk, off);
+            if (len <= 0)
+                break;
+            const char* end = (size_t)off + len < size? lastRecord(buf.first, buf.first + len) : buf.first + len;
+            buf.second = end > buf.first? end - buf.first : len;
+            buf.first[buf.second] = 0;
+            off += buf.second;
+            total += buf.second;
+            {   std::lock_guard<std::mutex> guard(pipe.lock);
+                pipe.full.push_back(buf); }
+            pipe.cond.notify_all();
+        }
+        {   std::lock_guard<std::mutex> guard(pipe.lock);
+            pipe.done = true; }
+        pipe.cond.notify_all();
+    });
+    for (;;) {
+        std::pair<char*, size_t> buf;
+        {   std::unique_lock<std::mutex> guard(pipe.lock);
+            pipe.cond.wait(guard, [&]() { return pipe.full.size() > 0 || pipe.done; });
+            if (!pipe.full.size())
+                break;
+            buf = pipe.full.front(); pipe.full.pop_front(); }
+        parse(record, buf.first, buf.first + buf.second);
+        {   std::lock_guard<std::mutex> guard(pipe.lock);
+            pipe.empty.push_back(buf); }
+        pipe.cond.notify_all();
+    }
+    reader.join();
+    for (size_t i = 0; i < pipe.empty.size(); i++)
+        free(pipe.empty[i].first);
+    return total == size;
+}
+
+static const struct { const char* name; bool (*run)(Lexem& record, int fd, size_t size, size_t chunk); } modes[] = {
+    { "memory", runMemory }, { "mmap", runMmap }, { "chunked", runChunked }, { "pread", runPread } };
+
+static void generate(const std::string& path, bool xml, size_t size)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        perror(path.c_str());
+        exit(1); }
+    static char buf[1 << 20];
+    setvbuf(file, buf, _IOFBF, sizeof(buf));
+    for (unsigned long n = 0; (size_t)ftell(file) < size; n++) {
+        if (xml) {
+            fprintf(file, "<client key=\"k%lu\" mail=\"user%lu@example.com\">\n", n, n);
+            for (unsigned long i = 0; i < 3 + n % 8; i++)
+                fprintf(file, "  <alert type=\"%s\" limit=\"%lu%%\" />\n", i & 1? "cpu" : "memory", (n + i) % 100);
+            fprintf(file, "</client>\n");
+        } else {
+            fprintf(file, "[section%lu]\n", n);
+            if (n % 4 == 0)
+                fprintf(file, "; generated section %lu\n", n);
+            for (unsigned long i = 0; i < 4 + n % 16; i++)
+                fprintf(file, "key%lu = value of %lu in section %lu\n", i, i, n);
+            fprintf(file, "\n");
+        }
+    }
+    fclose(file);
+}
+
+static void warmup(int fd)
+{
+    static char buf[1 << 20];
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+static std::vector<std::string> split(const char* list)
+{
+    std::vector<std::string> items;
+    std::istringstream text(list);
+    for (std::string item; std::getline(text, item, ','); )
+        items.push_back(item);
+    return items;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* modeList = "memory,mmap,chunked,pread";
+    const char* cacheList = "cold,warm";
+    size_t chunk = 1024 << 10;
+    if (argc < 2) {
+        printf("usage: %s <dir> [size MB] [-m memory,mmap,chunked,pread] [-c cold,warm] [-k chunk KB]\n", argv[0]);
+        return 1;
+    }
+    size_t size = (argc > 2 && argv[2][0] != '-'? atol(argv[2]) : 2048) << 20;
+    for (int i = 2; i + 1 < argc; i++) {
+        if (!strcmp(argv[i], "-m")) modeList = argv[++i];
+        else if (!strcmp(argv[i], "-c")) cacheList = argv[++i];
+        else if (!strcmp(argv[i], "-k")) chunk = (size_t)atol(argv[++i]) << 10;
+    }
+    IniRecord ini;
+    XmlRecord xml;
+    struct { const char* name; Lexem* record; } corpora[] = { { "ini", &ini.Record }, { "xml", &xml.Record } };
+    printf("%-6s %-8s %-6s %8s %8s %8s %10s %6s %12s %8s\n",
+        "corpus", "mode", "cache", "GB", "sec", "GB/s", "maxrss_MB", "cpu%", "records", "failed");
+    for (int c = 0; c < 2; c++) {
+        std::string path = std::string(argv[1]) + "/corpus." + corpora[c].name;
+        struct stat st;
+        if (stat(path.c_str(), &st) || (size_t)st.st_size < size) {
+            fprintf(stderr, "generating %s ...\n", path.c_str());
+            generate(path, c == 1, size);
+            stat(path.c_str(), &st); }
+        std::vector<std::string> caches = split(cacheList), names = split(modeList);
+        for (size_t k = 0; k < caches.size(); k++) {
+            for (size_t m = 0; m < names.size(); m++) {
+                int mode = -1;
+                for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+                    if (names[m] == modes[i].name)
+                        mode = i;
+                if (mode < 0 || (caches[k] != "cold" && caches[k] != "warm")) {
+                    fprintf(stderr, "mode %s/%s is not available\n", names[m].c_str(), caches[k].c_str());
+                    continue; }
+                int fd = open(path.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    perror(path.c_str());
+                    return 1; }
+                if (caches[k] == "cold") {
+                    fdatasync(fd);
+                    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                } else {
+                    warmup(fd);
+                    lseek(fd, 0, SEEK_SET); }
+                fflush(stdout);
+                pid_t pid = fork();
+                if (pid == 0) { // measure in a fresh process, so peak RSS belongs to the mode
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    bool ok = modes[mode].run(*corpora[c].record, fd, st.st_size, chunk);
+                    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    struct rusage ru;
+                    getrusage(RUSAGE_SELF, &ru);
+                    double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+                    double gb = st.st_size / 1e9;
+                    printf("%-6s %-8s %-6s %8.2f %8.2f %8.3f %10.1f %6.0f %12llu %8llu%s\n",
+                        corpora[c].name, modes[mode].name, caches[k].c_str(), gb, sec, gb / sec,
+                        ru.ru_maxrss / 1024., cpu * 100 / sec, records, failed, ok? "" : " (read error)");
+                    fflush(stdout);
+                    _exit(0); }
+                int status;
+                waitpid(pid, &status, 0);
+                close(fd);
+            }
+        }
+    }
+    return 0;
+}
@@ -27,6 +27,7 @@
 #ifndef BNFLITE_H
 #define BNFLITE_H
 
+#include <stdio.h>
 #include <string.h>
 #include <string>
 #include <list>
@@ -34,6 +35,14 @@
 #include <bitset>
 #include <algorithm>
 #include <typeinfo>
+#include <set>
+#include <map>
+#if defined(BNFLITE_PMR) // C++17: parser and grammar containers use polymorphic allocators
+#include <memory_resource>
+#define _BNF_STD std::pmr
+#else
+#define _BNF_STD std
+#endif
 
 namespace bnf
 {
@@ -68,6 +77,15 @@ namespace bnf
 //  - The second kind of callback is bound to 'Rule' element
 //      Interface<UserData> CallBack(std::vector<Interface<UserData>>& res) ...
 //      Bind(Rule, CallBack);
+//  - both kinds of callback can receive user context instead of using global state
+//      bool MyNumber(UserContext& cntx, const char* number_string, size_t length_of_number) ...
+//      Lexem Number = Iterate(1, Digit) + Action(MyNumber);
+//      Interface<UserData> CallBack(std::vector<Interface<UserData>>& res, UserContext& cntx) ...
+//      Analyze(root, text, &tail, result, &cntx);
+// Define BNFLITE_PMR to make parser and grammar containers allocator-aware (std::pmr):
+//  - parsers take std::pmr::memory_resource* in constructors to use e.g. monotonic buffers;
+//  - grammar elements use the default resource active at their construction;
+//  - the second kind of callbacks then receive std::pmr::vector<Interface<UserData>>&
 
 
 enum Limits {   maxCharNum = 256, maxLexemLength = 1024, maxIterate = 0x4096
@@ -79,37 +97,168 @@ enum Status {   eNone = 0, eErr = 0, eOk = 1,
                 eError = ((~(unsigned int)0) >> 1) + 1
             };
 
-class _Tie; class _And; class _Or; class _Cycle;
+class _Tie; class _And; class _Or; class _Cycle; class Memo; class Adapt; class Grammar; class _Base;
+class Completion;
+template <const bool neg> class _Pred;
+
+/* context stack of parsed positions kept as offsets from the beginning of the text */
+/* 32-bit offsets by default, define BNFLITE_CNTX64 for texts over 4GB */
+class _Context
+{
+#if defined(BNFLITE_CNTX64)
+    typedef size_t _Off;
+#else
+    typedef unsigned int _Off;
+#endif
+    _BNF_STD::vector<_Off> off;
+    const char* base;
+    size_t wide;    // all offsets OR-ed to detect overflow of 32-bit offsets
+    size_t peak;    // largest size since reset
+public:
+#if defined(BNFLITE_PMR)
+    explicit _Context(std::pmr::memory_resource* mr) :off(mr), base(0), wide(0), peak(0)
+        {};
+    _BNF_STD::vector<_Off>::allocator_type get_allocator() const
+        {   return off.get_allocator(); }
+#else
+    _Context() :base(0), wide(0), peak(0)
+        {};
+#endif
+    void reset(const char* text)
+        {   off.clear(); base = text; wide = 0; peak = 0; }
+    bool Fits(const char* ptr)  // false if the offset is over 32 bits, it is then kept by Overflow()
+        {   size_t pos = ptr - base; wide |= pos;
+            return sizeof(_Off) == sizeof(size_t) || (pos >> 16 >> 16) == 0; }
+    void push_back(const char* ptr)
+        {   size_t pos = ptr - base; wide |= pos;
+            off.push_back((_Off)pos);
+            if (off.size() > peak) peak = off.size(); }
+    const char* back() const
+        {   return base + off.back(); }
+    const char* operator[](size_t i) const
+        {   return base + off[i]; }
+    void set(size_t i, const char* ptr)
+        {   size_t pos = ptr - base; wide |= pos;
+            off[i] = (_Off)pos; }
+    size_t size() const
+        {   return off.size(); }
+    size_t capacity() const
+        {   return off.capacity(); }
+    size_t Peak() const
+        {   return peak; }
+    void resize(size_t n)
+        {   off.resize(n); }
+    void erase(size_t low, size_t up = 0)
+        {   off.erase(off.begin() + low,  up? off.begin() + up : off.end()); }
+    const char* Base() const
+        {   return base; }
+    bool Overflow() const
+        {   return sizeof(_Off) < sizeof(size_t) && (wide >> 16 >> 16) != 0; }
+};
+
+/* hook to watch parses started by Analyze calls, e.g. to collect metrics (see bnflite_stat.h) */
+class Observer
+{
+public:
+    Observer* next; // chain of observers
+    Observer(): next(0)
+        {};
+    virtual ~Observer()
+        {};
+    virtual void Enter(const _Base& parser, _Tie& root, const char* text)
+        {};
+    virtual void Leave(const _Base& parser, _Tie& root, const char* text, const char* stop, int stat)
+        {};
+};
+inline Observer*& _observers()
+    {   static Observer* head = 0; return head; }
+/* add observer to parsers created after the call (not thread safe, expected at start up),
+   an observer already in the chain is not added twice */
+inline void Observe(Observer* observer)
+    {   for (Observer* obs = _observers(); obs; obs = obs->next) {
+            if (obs == observer) return; }
+        observer->next = _observers(); _observers() = observer; }
+
+/* unique tag of user context type to check callbacks against the context of a parse */
+template <class C> inline const void* _type_of()
+    {   static const char tag = 0; return &tag; }
+
+/* internal trampolines to call user's callbacks with context of type C */
+template <class C> struct _Call
+{
+    static bool action(void* user, void* context, const char* lexem, size_t len)
+        {   return reinterpret_cast<bool (*)(C&, const char*, size_t)>(user)(*static_cast<C*>(context), lexem, len); }
+    template <class U> static U rule(void* user, _BNF_STD::vector<U>& res, void* context)
+        {   return reinterpret_cast<U (*)(_BNF_STD::vector<U>&, C&)>(user)(res, *static_cast<C*>(context)); }
+};
 
 /* context class to support the first kind of callback */
 class _Base // base parser class
 {
 public:
-    std::vector<const char*> cntxV;
+    _Context cntxV;
+    Memo* memo;     // optional memoization of lexem results (packrat parsing)
+    Adapt* adapt;   // optional profiling of "Accept First" disjunctions
+    Observer* observer; // observers of parses, Observe() ones by default
+    unsigned long steps;    // visits of tokens, lexems and rules in the last parse
+    const char* reach;      // furthest position read by tokens in the last parse
 protected: friend class Token; friend class Lexem; friend class Rule;
            friend class _And; friend class _Or; friend class Action;
+           friend class _Pred<true>; friend class _Pred<false>;
     int level;
+    int mute;       // first kind callbacks are not called (lookahead)
+    void* context;  // user context of callbacks (see Set_context)
+    const void* context_type;
     virtual int _analyze(_Tie& root, const char* text);
+    static void _leave(Observer* obs, const _Base& parser, _Tie& root, const char* text, const char* stop, int stat)
+        {   if (obs) { _leave(obs->next, parser, root, text, stop, stat);
+                obs->Leave(parser, root, text, stop, stat); } } // in reverse order of Enter
+    int _run(_Tie& root, const char* text, const char** pstop)
+        {   for (Observer* obs = observer; obs; obs = obs->next) {
+                obs->Enter(*this, root, text); }
+            const char* stop = 0;
+            int stat = _analyze(root, text) | Get_tail(&stop);
+            _leave(observer, *this, root, text, stop, stat);
+            if (pstop) *pstop = stop;
+            return stat; }
     virtual void _erase(int low, int up = 0)
-        {   cntxV.erase(cntxV.begin() + low,  up? cntxV.begin() + up : cntxV.end() ); }
+        {   cntxV.erase(low, up); }
     virtual std::pair<void*, int> _pre_call(void* callback)
         {   return std::make_pair((void*)0, 0); }
     virtual void _post_call(std::pair<void*, int> up)
         {};
     virtual void _do_call(std::pair<void*, int> up,
-            void* callback, const char* begin, const char* end,  const char* name)
+            void* callback, void* call, const char* begin, const char* end,  const char* name)
         {};
     virtual void _stub_call(const char* begin, const char* end,  const char* name)
         {};
+    virtual void _eof(const _Tie* token) // token failed at the end of the text
+        {};
 public:
-    _Base(): level(1)
+#if defined(BNFLITE_PMR)
+    explicit _Base(std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        :cntxV(mr), memo(0), adapt(0), observer(_observers()), steps(0), reach(0), level(1), mute(0),
+         context(0), context_type(0)
+        {};
+    std::pmr::memory_resource* Resource() const
+        {   return cntxV.get_allocator().resource(); }
+#else
+    _Base(): memo(0), adapt(0), observer(_observers()), steps(0), reach(0), level(1), mute(0),
+        context(0), context_type(0)
         {};
+#endif
     virtual ~_Base()
         {};
     int Get_tail(const char** pstop)
         {   const char* ptr = zero_parse(cntxV.back());
             if (pstop) *pstop = ptr;
-            return *ptr? eError|eRest: 0;  }
+            return (*ptr? eError|eRest: 0) | (cntxV.Overflow()? eError|eOver: 0);  }
+    // user context for callbacks declared with it, the parse fails with eError|eBadRule
+    // if such a callback is reached without a context of its type
+    template <class C> void Set_context(C* user)
+        {   context = user; context_type = user? _type_of<C>() : 0; }
+    template <class C> C* Get_context() const
+        {   return context_type == _type_of<C>()? static_cast<C*>(context) : 0; }
     // primary interface to start parsing of text against constructed rules
     // there are 3 kins of parsing errors presented together with eError in returned status
     // 1) eBadRule, eBadLexem - means the rules tree is not properly built
@@ -118,6 +267,13 @@ public:
     friend int Analyze(_Tie& root, const char* text, const char** pstop = 0);
     template <class U> friend int Analyze(_Tie& root, const char* text, const char** pstop, U& u);
     template <class P> friend int Analyze(_Tie& root, const char* text, P& parser);
+    template <class C> friend int Analyze(_Tie& root, const char* text, const char** pstop, C* context);
+    template <class U, class C> friend int Analyze(_Tie& root, const char* text, const char** pstop, U& u,
+        C* context);
+#if defined(BNFLITE_PMR)
+    template <class U> friend int Analyze(_Tie& root, const char* text, const char** pstop, U& u,
+        std::pmr::memory_resource* mr);
+#endif
     // default parser procedure to skip special symbols
     virtual  const char* zero_parse(const char* ptr)
         {   for (char cc = *ptr; cc != 0; cc = *++ptr) {
@@ -139,34 +295,43 @@ public:
 class _Tie
 {
     bool _is_compound();
-protected:              friend class _Base;  friend class ExtParser;
+protected:              friend class _Base;  friend class ExtParser; friend struct Footprint; friend class Memo;
+    friend class Completion;
+    friend class Adapt; friend class Grammar; template <const bool neg> friend class _Pred;
     friend class _And;  friend class _Or;   friend class _Cycle;
     friend class Token; friend class Lexem; friend class Rule;
     bool inner;
-    mutable std::vector<const _Tie*> use;
-    mutable std::list<const _Tie*> usage;
-    std::string name;
+    mutable _BNF_STD::vector<const _Tie*> use;
+    mutable _BNF_STD::list<const _Tie*> usage;
+    _BNF_STD::string name;
     template<class T> static void _setname(T* t, const char * name = 0)
         {   static int cnt = 0;
             if (name) { t->name = name; }
             else { t->name = typeid(*t).name() + _NAME_OFF;
                    for( int i = ++cnt; i != 0; i /= 10) {
                        t->name += '0' + i - (i/10)*10; } } }
+    template<class C> static void _take(C& to, C& from)
+        {   // pmr containers of elements built under other default resources must not be swapped
+#if defined(BNFLITE_PMR)
+            if (to.get_allocator() != from.get_allocator()) {
+                to.assign(from.begin(), from.end()); from.clear(); return; }
+#endif
+            to.swap(from); }
     void _clone(const _Tie* lnk)
-        {   usage.swap(lnk->usage);
-            for (std::list<const _Tie*>::const_iterator usg = usage.begin(); usg != usage.end(); ++usg) {
+        {   _take(usage, lnk->usage);
+            for (_BNF_STD::list<const _Tie*>::const_iterator usg = usage.begin(); usg != usage.end(); ++usg) {
                 for (unsigned i = 0; i < (*usg)->use.size(); i++) {
                    if ((*usg)->use[i] == lnk) {
                         (*usg)->use[i] = this; } } }
-            use.swap(lnk->use);
+            _take(use, lnk->use);
             for (unsigned i = 0; i < use.size(); i++) {
                 if (!use[i]) continue;
-                std::list<const _Tie*>::iterator itr =
-                    std::find(use[i]->usage.begin(), use[i]->usage.end(), lnk);
+                _BNF_STD::list<const _Tie*>::reverse_iterator itr = // temporary is the last user
+                    std::find(use[i]->usage.rbegin(), use[i]->usage.rend(), lnk);
                 *itr = this; }
             if(lnk->inner) {
                 delete lnk; } }
-    _Tie(std::string nm = "") :inner(false), name(nm)
+    _Tie(std::string nm = "") :inner(false), name(nm.begin(), nm.end())
         {};
     explicit _Tie(const _Tie* lnk) : inner(true), name(lnk->name)
         {   _clone(lnk); }
@@ -175,10 +340,14 @@ protected:              friend class _Base;  friend class ExtParser;
     virtual ~_Tie()
         {   for (unsigned int i = 0; i < use.size(); i++) {
                 if (use[i]) {
-                    use[i]->usage.remove(this);
+                    _unuse(use[i], this);
                     if ( use[i]->inner && use[i]->usage.size() == 0) {
                         delete use[i]; }
                     use[i] = 0; } } }
+    static void _unuse(const _Tie* lnk, const _Tie* user) // one link per use, recent users are last
+        {   _BNF_STD::list<const _Tie*>::reverse_iterator itr =
+                std::find(lnk->usage.rbegin(), lnk->usage.rend(), user);
+            if (itr != lnk->usage.rend()) lnk->usage.erase(--itr.base()); }
     static int call_1st(const _Tie* lnk, _Base* parser)
         {   return lnk->_parse(parser); }
     void _clue(const _Tie& link)
@@ -266,19 +435,25 @@ class Token: public _Tie
     Token& operator=(const _Tie&);
     explicit Token(const _Tie&);
     std::bitset<bnf::maxCharNum> match;
- protected: friend class _Tie;
+ protected: friend class _Tie; friend struct Footprint; friend class Adapt; friend class Completion;
     explicit Token(const Token* tkn) :_Tie(tkn), match(tkn->match)
         {};
     virtual int _parse(_Base* parser) const throw()
         {   const char* cc = parser->cntxV.back();
+            parser->steps++;
             if (parser->level)
                 cc = parser->zero_parse(cc);
             if (match[*((unsigned char*)cc)]) {
+                if (!parser->cntxV.Fits(cc + 1))
+                    return eError|eOver;
                 if (parser->level) {
                     parser->_stub_call(cc, cc + 1, name.c_str());
                     parser->cntxV.push_back(cc); }
                 parser->cntxV.push_back(++cc);
+                if (cc > parser->reach) parser->reach = cc;
                 return  *cc ? true : true|eEof; }
+            if (cc > parser->reach) parser->reach = cc;
+            if (!*cc) parser->_eof(this);
             return 0; }
 public:
     Token(const char c) :_Tie(std::string(1, c))
@@ -321,16 +496,26 @@ inline Token operator""_T(const char* sample, size_t len)
 class Action: public _Tie
 {
     bool (*action)(const char* lexem, size_t len);
+    void* user;         // callback with user context, called through the trampoline
+    bool (*call)(void* user, void* context, const char* lexem, size_t len);
+    const void* type;   // type of user context
     Action(_Tie&);
 protected:  friend class _Tie;
-    explicit Action(const Action* a) :_Tie(a), action(a->action)
+    explicit Action(const Action* a) :_Tie(a), action(a->action), user(a->user), call(a->call), type(a->type)
         {};
     int _parse(_Base* parser) const throw()
-        {   std::vector<const char*>::reverse_iterator itr = parser->cntxV.rbegin() + 1;
-            return (*action)(*itr, parser->cntxV.back() - *itr); }
+        {   if (parser->mute)
+                return eOk;
+            const char* org = parser->cntxV[parser->cntxV.size() - 2];
+            if (call)
+                return type != parser->context_type? eError|eBadRule   // filter without its context
+                    : (*call)(user, parser->context, org, parser->cntxV.back() - org);
+            return (*action)(org, parser->cntxV.back() - org); }
 public:
     Action(bool (*action)(const char* lexem, size_t len), const char *name = "")
-        :_Tie(name), action(action) {};
+        :_Tie(name), action(action), user(0), call(0), type(0) {};
+    template <class C> Action(bool (*action)(C& context, const char* lexem, size_t len), const char *name = "")
+        :_Tie(name), action(0), user(reinterpret_cast<void*>(action)), call(&_Call<C>::action), type(_type_of<C>()) {};
     virtual ~Action()
         {   _safe_delete(this); }
 };
@@ -382,6 +567,58 @@ inline _And operator+(const char* s, const _Tie& link)
 inline _And operator+(bool (*f)(const char*, size_t), const _Tie& link)
     {   return _And(Action(f), link); }
 
+/* profile guided reordering of "Accept First" disjunctions like AcceptFirst() | a | b | c */
+/* e.g. Adapt adapt(1000); parser.adapt = &adapt; Analyze(root, text, parser); ... */
+/* Alternatives are reordered by number of hits only if they are never empty and their */
+/* first characters are disjoint (so at most one of them can match and the result is the same) */
+/* Note: reordering changes the grammar, it must not be used by other parsers at the time */
+class Adapt
+{
+    struct _First
+    {   std::bitset<bnf::maxCharNum> set; // first characters
+        int flag;                         // 1 - can be empty, 2 - unknown or has side effects
+        bool busy;                        // in progress (recursion)
+    };
+    struct _Entry
+    {   bool checked;
+        _BNF_STD::vector<unsigned long> cnt; // hits of alternatives, empty if not reorderable
+        _Entry(): checked(false)
+            {};
+    };
+    std::map<const _Tie*, _First> first;
+    std::map<const _Tie*, _Entry> table;
+    const _Tie* last;
+    _Entry* entry;
+    unsigned long period;
+    unsigned long parses;
+    _First _first(const _Tie* tie);
+    bool _check(const _Tie* alt);
+    _Entry& _entry(const _Tie* alt)
+        {   if (alt != last) {
+                last = alt; entry = &table[alt];
+                if (!entry->checked) {
+                    entry->checked = true;
+                    if (_check(alt)) entry->cnt.resize(alt->use.size()); } }
+            return *entry; }
+protected: friend class _Or; friend class _Base;
+    void _hit(const _Tie* alt, unsigned int i)
+        {   _Entry& e = _entry(alt);
+            if (i < e.cnt.size()) e.cnt[i]++; }
+    void _start()
+        {   if (period && ++parses % period == 0) Reorder(); }
+public:
+    size_t reorders;
+    explicit Adapt(unsigned long period = 0) :last(0), entry(0), period(period), parses(0), reorders(0)
+        {};
+    // put most frequent alternatives first, return number of changed disjunctions
+    int Reorder();
+    // write collected hits, keyed by names of disjunctions and alternatives
+    bool Save(FILE* file) const;
+    // read hits for disjunctions reachable from root and reorder them, return number of found ones
+    // or -1 (bad file or an alternative not found by name)
+    int Load(FILE* file, const _Tie& root);
+};
+
 /* internal class to support disjunction constructions of BNF elements */
 class _Or: public _Tie
 {
@@ -393,23 +630,28 @@ protected: friend class _Tie;
     virtual int _parse(_Base* parser) const throw()
         {   int stat = 0; int max = 0; int tmp = -1;
             const char* org = parser->cntxV.back();
-            unsigned int msize; unsigned int size = parser->cntxV.size();
+            unsigned int msize; unsigned int size = parser->cntxV.size(); unsigned int best = size;
             for (unsigned i = 0; i < use.size(); i++, stat &= ~(eOk|eRet|eError)) {
                 msize = parser->cntxV.size();
-                if (msize > size) {
-                    parser->cntxV.push_back(org); }
+                if (msize > size) { // keep the best alternative, start the next one above it
+                    if (parser->level) {
+                        parser->_stub_call(org, org, ""); }
+                    parser->cntxV.push_back(org); parser->cntxV.push_back(org); }
                 stat |= use[i]->_parse(parser);
                 if (stat & (eOk|eError)) {
                     tmp = parser->cntxV.back() - org;
                     if (  (tmp > max) || (tmp > 0 && (stat & (eRet|e1st|eError)))  )  {
                         max = tmp;
-                        if (msize > size) {
-                            parser->_erase(size, msize + 1); }
+                        best = msize > size? msize + 2 : size;
                         if (stat & (eRet|e1st|eError)) {
+                            if ((stat & e1st) && parser->adapt) {
+                                parser->adapt->_hit(this, i); }
                             break; }
                         continue;  }  }
                 if (parser->cntxV.size() > msize) {
                     parser->_erase(msize); } }
+            if (best > size) { // commit the winner once, whatever number of alternatives were better before
+                parser->_erase(size, best); }
             return (max || tmp >= 0 ? stat | eOk: stat & ~eOk) & ~(e1st|eRet); }
 public:
     ~_Or()
@@ -437,6 +679,70 @@ inline bool _Tie::_is_compound()
         {return dynamic_cast<_And*>(this) || dynamic_cast<_Or*>(this); }
 
 
+/* memoization of lexem results to avoid re-parsing in alternatives (packrat parsing) */
+/* e.g. Memo memo(4096); parser.memo = &memo; Analyze(root, text, parser); */
+/* Entries are kept only for a sliding window behind the furthest memoized position */
+/* so a parse of a long text/stream gets most of the benefit with bounded memory */
+class Memo
+{
+    typedef std::pair<size_t, const _Tie*> _Key;       // offset of lexem and lexem
+    struct _Val
+    {   int stat;       // status
+        size_t end;     // offset of the end or 0
+        size_t reach;   // offset of the furthest character read
+    };
+    std::map<_Key, _Val> table;
+    std::map<const _Tie*, bool> pure;   // lexem has no first kind callbacks inside
+    size_t window;
+    size_t front;
+protected: friend class Lexem; friend class _Base;
+    void _start()
+        {   if (!reuse) { table.clear(); front = 0; } }
+    bool _pure(const _Tie* lexem)
+        {   std::map<const _Tie*, bool>::iterator itr = pure.find(lexem);
+            if (itr != pure.end())
+                return itr->second;
+            bool ok = true; std::set<const _Tie*> seen; std::vector<const _Tie*> stack(1, lexem);
+            while (ok && stack.size()) {
+                const _Tie* tie = stack.back(); stack.pop_back();
+                if (!tie || !seen.insert(tie).second)
+                    continue;
+                ok = !dynamic_cast<const Action*>(tie);
+                stack.insert(stack.end(), tie->use.begin(), tie->use.end()); }
+            return pure[lexem] = ok; }
+    const _Val* _get(const _Tie* lexem, size_t pos)
+        {   std::map<_Key, _Val>::iterator itr = table.find(_Key(pos, lexem));
+            if (itr == table.end()) {
+                misses++; return 0; }
+            hits++; return &itr->second; }
+    void _put(const _Tie* lexem, size_t pos, int stat, size_t end, size_t reach)
+        {   _Val& val = table[_Key(pos, lexem)];
+            val.stat = stat; val.end = end; val.reach = reach;
+            if (pos > front) {
+                front = pos;
+                if (front > window) Cut(front - window); } }
+public:
+    size_t hits, misses, evicted;
+    bool reuse;     // keep entries between parses of the same (edited) text, see Edit
+    explicit Memo(size_t window = ~(size_t)0) :window(window), front(0), hits(0), misses(0), evicted(0),
+        reuse(false)
+        {};
+    // drop entries before offset 'pos' (e.g. at record boundaries, no backtracking expected there)
+    void Cut(size_t pos)
+        {   std::map<_Key, _Val>::iterator up = table.lower_bound(_Key(pos, (const _Tie*)0));
+            for (std::map<_Key, _Val>::iterator itr = table.begin(); itr != up; evicted++) {
+                table.erase(itr++); } }
+    // text is changed from offset 'pos': drop entries which have read there
+    void Edit(size_t pos)
+        {   for (std::map<_Key, _Val>::iterator itr = table.begin(); itr != table.end(); ) {
+                if (itr->second.reach >= pos) { table.erase(itr++); evicted++; }
+                else { ++itr; } } }
+    size_t Size() const
+        {   return table.size(); }
+    void Clear()
+        {   table.clear(); pure.clear(); front = 0; }
+};
+
 /* interface class for lexem */
 class Lexem: public _Tie
 {
@@ -446,20 +752,42 @@ protected: friend class _Tie;
     explicit Lexem(Lexem* lxm) :_Tie(lxm)
         {};
     virtual int _parse(_Base* parser) const throw()
-        {   if (!use.size())
+        {   parser->steps++;
+            if (!use.size())
                 return eError|eBadLexem;
             if (!parser->level || dynamic_cast<const Action*>(use[0]))
                 return use[0]->_parse(parser);
             int size = parser->cntxV.size();
             const char* org = parser->zero_parse(parser->cntxV.back());
+            if (!parser->cntxV.Fits(org))
+                return eError|eOver;
+            Memo* memo = parser->memo && parser->memo->_pure(this)? parser->memo : 0;
+            size_t pos = org - parser->cntxV.Base();
+            const char* reach = parser->reach;
+            if (memo) {
+                const Memo::_Val* val = memo->_get(this, pos);
+                if (val) {
+                    if (val->end) {
+                        parser->_stub_call(org, parser->cntxV.Base() + val->end, name.c_str());
+                        parser->cntxV.push_back(org);
+                        parser->cntxV.push_back(parser->cntxV.Base() + val->end); }
+                    if (parser->cntxV.Base() + val->reach > reach)
+                        parser->reach = parser->cntxV.Base() + val->reach;
+                    return val->stat; }
+                parser->reach = org; }
             parser->cntxV.push_back(org);
             parser->level--;
             int  stat = use[0]->_parse(parser);
             parser->level++;
-            if ((stat & eOk) && parser->cntxV.size() - size > 1) {
+            size_t end = 0;
+            if ((stat & eOk) && parser->cntxV.size() - size > 1 && !parser->cntxV.Overflow()) {
                 parser->_stub_call(org, parser->cntxV.back(), name.c_str());
-                parser->cntxV[(++size)++] = parser->cntxV.back(); }
+                end = parser->cntxV.back() - parser->cntxV.Base();
+                parser->cntxV.set(++size, parser->cntxV.back()); size++; }
             parser->cntxV.resize(size);
+            if (memo) {
+                memo->_put(this, pos, stat, end, parser->reach - parser->cntxV.Base());
+                if (reach > parser->reach) parser->reach = reach; }
             return stat; }
 public:
     Lexem(const char *literal, bool cs = 0) :_Tie()
@@ -490,39 +818,47 @@ public:
 class Rule : public _Tie
 {
     void* callback;
+    void* call;         // trampoline of callback with user context
+    const void* type;   // type of user context
 protected:  friend class _Tie; friend class _And;
-    explicit Rule(const Rule* rl) :_Tie(rl), callback(rl->callback)
+    explicit Rule(const Rule* rl) :_Tie(rl), callback(rl->callback), call(rl->call), type(rl->type)
     {};
     virtual int _parse(_Base* parser) const throw()
-        {   if (!use.size() || !parser->level)
+        {   parser->steps++;
+            if (!use.size() || !parser->level)
                 return eError|eBadRule;
             if (dynamic_cast<const Action*>(use[0])) {
                 return use[0]->_parse(parser); }
             int size = parser->cntxV.size();
-            std::pair<void*, int> up = parser->_pre_call(callback);
+            void* user = type && type != parser->context_type? 0 : callback;
+            if (!user && callback && !parser->mute)   // callback without its context, unless muted (Completion)
+                return eError|eBadRule;
+            std::pair<void*, int> up = parser->_pre_call(user);
             int stat = use[0]->_parse(parser);
-            if ((stat & eOk) && parser->cntxV.size() - size > 1) {
-                parser->_do_call(up, callback, parser->cntxV[size], parser->cntxV.back(), name.c_str());
-                parser->cntxV[(++size)++] = parser->cntxV.back(); }
+            if ((stat & eOk) && parser->cntxV.size() - size > 1 && !parser->cntxV.Overflow()) {
+                parser->_do_call(up, user, call, parser->cntxV[size], parser->cntxV.back(), name.c_str());
+                parser->cntxV.set(++size, parser->cntxV.back()); size++; }
             parser->cntxV.resize(size);
             parser->_post_call(up);
             return stat; }
 public:
-    explicit Rule() :_Tie(), callback(0)
+    explicit Rule() :_Tie(), callback(0), call(0), type(0)
         {   _setname(this); }
     virtual ~Rule()
         {   _safe_delete(this); }
-    Rule(const _Tie& link) :_Tie(), callback(0)
+    Rule(const _Tie& link) :_Tie(), callback(0), call(0), type(0)
         {   const Rule* rl = dynamic_cast<const Rule*>(&link);
-            if (rl) { _clone(&link);  callback = rl->callback; name = rl->name; }
+            if (rl) { _clone(&link);  callback = rl->callback; call = rl->call; type = rl->type; name = rl->name; }
             else { _clue(link);   callback = 0; _setname(this);  } }
     Rule& operator=(const _Tie& link)
         {   _clue(link); return *this; }
     Rule& operator=(const Rule& rule)
         {   if (&rule == this) return *this;
             return this->operator=((const _Tie&)rule); }
-    template <class U> friend Rule& Bind(Rule& rule, U (*callback)(std::vector<U>&));
-    template <class U> Rule& operator[](U (*callback)(std::vector<U>&));
+    template <class U> friend Rule& Bind(Rule& rule, U (*callback)(_BNF_STD::vector<U>&));
+    template <class U> Rule& operator[](U (*callback)(_BNF_STD::vector<U>&));
+    template <class U, class C> friend Rule& Bind(Rule& rule, U (*callback)(_BNF_STD::vector<U>&, C&));
+    template <class U, class C> Rule& operator[](U (*callback)(_BNF_STD::vector<U>&, C&));
 };
 
 /* friendly debug interface */
@@ -535,7 +871,7 @@ class _Cycle: public _Tie
     unsigned int min;
     unsigned int max;
     int flag;
-protected: friend class _Tie;
+protected: friend class _Tie; friend class Adapt; friend class Grammar;
     explicit _Cycle(const _Cycle* cl) :_Tie(cl), min(cl->min), max(cl->max), flag(cl->flag)
         {};
     _Cycle(const _Cycle& cycle) :_Tie(cycle), min(cycle.min), max(cycle.max), flag(cycle.flag)
@@ -574,53 +910,402 @@ inline _Cycle Iterate(int at_least, const Lexem& lexem, int total, int limit)
 inline _Cycle Series(int at_least, const Token& token, int total, int limit)
     {   return _Cycle(at_least, token, total, limit); }
 
+/* internal class to support lookahead predicates: Not(x) - x does not follow, And(x) - x follows */
+/* The operand is checked as lexem (no callbacks, no results) and the text is not consumed, */
+/* e.g. Lexem Comment = Lexem("<!--") + *(Not("-->") + Token(1, 255)) + Lexem("-->"); */
+template <const bool neg> class _Pred: public _Tie
+{
+protected: friend class _Tie;
+    explicit _Pred(const _Pred* pr) :_Tie(pr)
+        {};
+    virtual int _parse(_Base* parser) const throw()
+        {   int size = parser->cntxV.size(); int level = parser->level;
+            if (level) {
+                const char* org = parser->zero_parse(parser->cntxV.back());
+                if (!parser->cntxV.Fits(org))
+                    return eError|eOver;
+                parser->cntxV.push_back(org);
+                parser->level = 0; }
+            parser->mute++;
+            int stat = use[0]->_parse(parser);
+            parser->mute--;
+            parser->level = level;
+            parser->cntxV.resize(size);
+            if (stat & (eBadRule|eBadLexem))
+                return stat;
+            if (parser->cntxV.Overflow())
+                return eError|eOver;
+            return ((stat & eOk) != 0) != neg? eOk : eNone; }
+    _Pred(const _Tie& link) :_Tie(std::string(neg? "!" : "&"))
+        {   name += link.name; _clue(link); }
+public:
+    _Pred(const _Pred& pred) :_Tie(pred)
+        {};
+    ~_Pred()
+        {   _safe_delete(this); }
+    friend _Pred<true> Not(const _Tie& link);
+    friend _Pred<false> And(const _Tie& link);
+};
+inline _Pred<true> Not(const _Tie& link)
+    {   return _Pred<true>(link); }
+inline _Pred<true> Not(const char* literal)
+    {   return Not(Lexem(literal)); }
+inline _Pred<false> And(const _Tie& link)
+    {   return _Pred<false>(link); }
+inline _Pred<false> And(const char* literal)
+    {   return And(Lexem(literal)); }
+
+inline Adapt::_First Adapt::_first(const _Tie* tie)
+{   std::map<const _Tie*, _First>::iterator itr = first.find(tie);
+    if (itr != first.end()) {
+        if (!itr->second.busy)
+            return itr->second;
+        _First f; f.flag = 2; f.busy = false;
+        return f; }
+    _First& res = first[tie]; res.flag = 0; res.busy = true;
+    _First f; f.flag = 0; f.busy = false;
+    const Token* tkn = dynamic_cast<const Token*>(tie);
+    const _Cycle* cl = dynamic_cast<const _Cycle*>(tie);
+    if (tkn) {
+        f.set = tkn->match; }
+    else if (dynamic_cast<const _And*>(tie)) {
+        f.flag = 1;
+        for (unsigned int i = 0; i < tie->use.size() && f.flag == 1; i++) {
+            _First e = _first(tie->use[i]);
+            f.set |= e.set; f.flag = (e.flag & 2) | (f.flag & e.flag); } }
+    else if (dynamic_cast<const _Or*>(tie)) {
+        for (unsigned int i = 0; i < tie->use.size(); i++) {
+            _First e = _first(tie->use[i]);
+            f.set |= e.set; f.flag |= e.flag; } }
+    else if (cl) {
+        f = _first(cl->use[0]);
+        if (!cl->min) f.flag |= 1; }
+    else if ((dynamic_cast<const Lexem*>(tie) || dynamic_cast<const Rule*>(tie)) && tie->use.size()) {
+        f = _first(tie->use[0]); }
+    else if (dynamic_cast<const Null*>(tie) || dynamic_cast<const Return*>(tie)) {
+        f.flag = 1; }
+    else if (!dynamic_cast<const AcceptFirst*>(tie)) {
+        f.flag = 2; } // actions, other controls and custom elements
+    f.busy = false;
+    return first[tie] = f; }
+
+inline bool Adapt::_check(const _Tie* alt)
+{   if (alt->use.size() < 3 || !dynamic_cast<const AcceptFirst*>(alt->use[0]))
+        return false;
+    std::bitset<bnf::maxCharNum> all;
+    for (unsigned int i = 1; i < alt->use.size(); i++) {
+        _First f = _first(alt->use[i]);
+        if (f.flag || (all & f.set).any())
+            return false;
+        all |= f.set; }
+    return true; }
+
+inline int Adapt::Reorder()
+{   int changed = 0;
+    for (std::map<const _Tie*, _Entry>::iterator itr = table.begin(); itr != table.end(); ++itr) {
+        _BNF_STD::vector<unsigned long>& cnt = itr->second.cnt;
+        _BNF_STD::vector<const _Tie*>& use = itr->first->use;
+        if (cnt.size() != use.size())
+            continue;
+        bool moved = false;
+        for (unsigned int i = 2; i < use.size(); i++) { // stable insertion sort, AcceptFirst stays first
+            for (unsigned int j = i; j > 1 && cnt[j] > cnt[j - 1]; j--, moved = true) {
+                std::swap(cnt[j], cnt[j - 1]); std::swap(use[j], use[j - 1]); } }
+        for (unsigned int i = 0; i < cnt.size(); i++) {
+            cnt[i] -= cnt[i] / 2; } // age hits to follow changes of the input
+        changed += moved; }
+    reorders += changed;
+    return changed; }
+
+inline bool Adapt::Save(FILE* file) const
+{   for (std::map<const _Tie*, _Entry>::const_iterator itr = table.begin(); itr != table.end(); ++itr) {
+        const _BNF_STD::vector<unsigned long>& cnt = itr->second.cnt;
+        if (!cnt.size())
+            continue;
+        fprintf(file, "or %u %u ", (unsigned)cnt.size(), (unsigned)itr->first->name.size());
+        fwrite(itr->first->name.data(), 1, itr->first->name.size(), file); fputc('\n', file);
+        for (unsigned int i = 0; i < cnt.size(); i++) {
+            const _Tie* tie = itr->first->use[i];
+            fprintf(file, "%lu %u ", cnt[i], (unsigned)tie->name.size());
+            fwrite(tie->name.data(), 1, tie->name.size(), file); fputc('\n', file); } }
+    return !ferror(file); }
+
+inline int Adapt::Load(FILE* file, const _Tie& root)
+{   typedef std::vector<std::pair<std::string, unsigned long> > Hits;
+    std::map<std::string, Hits> prof;
+    for (unsigned int n, len; fscanf(file, " or %u %u", &n, &len) == 2; ) {
+        std::string name(len, 0);   // one separator, names may start with white space
+        if (fgetc(file) != ' ' || (len && fread(&name[0], 1, len, file) != len))
+            return -1;
+        Hits& hits = prof[name];
+        for (unsigned int i = 0; i < n; i++) {
+            unsigned long cnt;
+            if (fscanf(file, "%lu %u", &cnt, &len) != 2 || fgetc(file) != ' ')
+                return -1;
+            std::string alt(len, 0);
+            if (len && fread(&alt[0], 1, len, file) != len)
+                return -1;
+            hits.push_back(std::make_pair(alt, cnt)); } }
+    if (ferror(file) || !feof(file))
+        return -1;
+    int found = 0;
+    std::set<const _Tie*> seen; std::vector<const _Tie*> stack(1, &root);
+    while (stack.size()) {
+        const _Tie* tie = stack.back(); stack.pop_back();
+        if (!tie || !seen.insert(tie).second)
+            continue;
+        stack.insert(stack.end(), tie->use.begin(), tie->use.end());
+        std::map<std::string, Hits>::iterator itr = prof.find(std::string(tie->name.begin(), tie->name.end()));
+        if (itr == prof.end() || !dynamic_cast<const _Or*>(tie))
+            continue;
+        _Entry& e = _entry(tie);
+        if (e.cnt.size() != itr->second.size())
+            continue;
+        Hits hits = itr->second;
+        std::vector<unsigned long> cnt(e.cnt.size());
+        for (unsigned int i = 0; i < cnt.size(); i++) {
+            Hits::iterator h = hits.begin();
+            while (h != hits.end() && !(h->first.size() == tie->use[i]->name.size() &&
+                    std::equal(h->first.begin(), h->first.end(), tie->use[i]->name.begin())))
+                ++h;
+            if (h == hits.end())
+                return -1;  // alternatives of another grammar
+            cnt[i] = h->second; hits.erase(h); }
+        e.cnt.assign(cnt.begin(), cnt.end());
+        found++; }
+    Reorder();
+    return found; }
+
+/* memory accounting of constructed rules: Footprint fp = Footprint::Inspect(root); */
+struct Footprint
+{
+    enum Kind { nToken, nAnd, nOr, nCycle, nLexem, nRule, nAction, nOther, nKinds };
+    unsigned int nodes[nKinds]; //  number of elements by kind
+    unsigned int shared;        //  elements referenced from several places (shared sub-graphs)
+    size_t objects;             //  bytes of element objects
+    size_t names;               //  bytes reserved for names
+    size_t bitsets;             //  bytes of token character sets
+    size_t links;               //  bytes of use/usage links between elements
+    size_t Bytes() const
+        {   return objects + names + links; }
+    static Footprint Inspect(const _Tie& root)
+        {   Footprint fp; memset(&fp, 0, sizeof(fp));
+            std::set<const _Tie*> seen; std::vector<const _Tie*> stack(1, &root);
+            while (stack.size()) {
+                const _Tie* tie = stack.back(); stack.pop_back();
+                if (!tie || !seen.insert(tie).second)
+                    continue;
+                const Token* tkn = dynamic_cast<const Token*>(tie);
+                if (tkn) { fp.nodes[nToken]++; fp.objects += sizeof(Token); fp.bitsets += sizeof(tkn->match); }
+                else if (dynamic_cast<const _And*>(tie)) { fp.nodes[nAnd]++; fp.objects += sizeof(_And); }
+                else if (dynamic_cast<const _Or*>(tie)) { fp.nodes[nOr]++; fp.objects += sizeof(_Or); }
+                else if (dynamic_cast<const _Cycle*>(tie)) { fp.nodes[nCycle]++; fp.objects += sizeof(_Cycle); }
+                else if (dynamic_cast<const Lexem*>(tie)) { fp.nodes[nLexem]++; fp.objects += sizeof(Lexem); }
+                else if (dynamic_cast<const Rule*>(tie)) { fp.nodes[nRule]++; fp.objects += sizeof(Rule); }
+                else if (dynamic_cast<const Action*>(tie)) { fp.nodes[nAction]++; fp.objects += sizeof(Action); }
+                else { fp.nodes[nOther]++; fp.objects += sizeof(_Tie); }
+                fp.shared += tie->usage.size() > 1;
+                fp.names += tie->name.capacity();
+                fp.links += tie->use.capacity() * sizeof(_Tie*) + tie->usage.size() * 3 * sizeof(_Tie*);
+                stack.insert(stack.end(), tie->use.begin(), tie->use.end()); }
+            return fp; }
+};
+
 inline int _Base::_analyze(_Tie& root, const char* text)
-{   cntxV.push_back(text); cntxV.push_back(text);
+{   cntxV.reset(text); cntxV.push_back(text); cntxV.push_back(text); steps = 0; reach = text;
+    if (memo) memo->_start();
+    if (adapt) adapt->_start();
     return root._parse(this); }
 
 /* context class to support the second kind of callback */
 template <class U> class _Parser : public _Base
 {
 protected:
-    std::vector<U>* cntxU;
+    _BNF_STD::vector<U>* cntxU;
     unsigned int off;
+#if defined(BNFLITE_PMR)
+    _BNF_STD::vector<U>* _new_frame()
+        {   std::pmr::polymorphic_allocator<_BNF_STD::vector<U> > alloc(Resource());
+            _BNF_STD::vector<U>* frame = alloc.allocate(1);
+            alloc.construct(frame);
+            return frame; }
+    void _delete_frame(_BNF_STD::vector<U>* frame)
+        {   std::pmr::polymorphic_allocator<_BNF_STD::vector<U> > alloc(Resource());
+            frame->~vector();
+            alloc.deallocate(frame, 1); }
+#else
+    std::vector<U>* _new_frame()
+        {   return new std::vector<U>; }
+    void _delete_frame(std::vector<U>* frame)
+        {   delete frame; }
+#endif
     void _erase(int low, int up = 0)
-        {   cntxV.erase(cntxV.begin() + low,  up? cntxV.begin() + up : cntxV.end() );
+        {   cntxV.erase(low, up);
             if (cntxU && level)
                 cntxU->erase(cntxU->begin() + (low - off) / 2,
                  up? cntxU->begin() + (up - off) / 2 : cntxU->end()); }
     virtual std::pair<void*, int> _pre_call(void* callback)
         {   std::pair<void*, int> up = std::make_pair(cntxU, off);
-            cntxU = callback? new std::vector<U> : 0;
+            cntxU = callback? _new_frame() : 0;
             off = callback? cntxV.size() : 0;
             return up; }
     virtual void  _post_call(std::pair<void*, int> up)
         {   if (cntxU) {
-                delete cntxU; }
-            cntxU = (std::vector<U>*)up.first;
+                _delete_frame(cntxU); }
+            cntxU = (_BNF_STD::vector<U>*)up.first;
             off = up.second; }
+    U _call(void* callback, void* call)
+        {   return call? reinterpret_cast<U(*)(void*, _BNF_STD::vector<U>&, void*)>(call)(callback, *cntxU, context)
+                : reinterpret_cast<U(*)(_BNF_STD::vector<U>&)>(callback)(*cntxU); }
     virtual void _do_call(std::pair<void*, int> up,
-            void* callback, const char* begin, const char* end, const char* name)
+            void* callback, void* call, const char* begin, const char* end, const char* name)
         {   if (callback) {
                 if (up.first) {
-                    ((std::vector<U>*)up.first)->push_back(U(reinterpret_cast<
-                        U(*)(std::vector<U>&)>(callback)(*cntxU), begin, end - begin, name));
-                } else { reinterpret_cast<U(*)(std::vector<U>&)>(callback)(*cntxU); }
+                    ((_BNF_STD::vector<U>*)up.first)->push_back(U(_call(callback, call), begin, end - begin, name));
+                } else { _call(callback, call); }
             } else if (up.first) {
-                    ((std::vector<U>*)up.first)->push_back(U(begin, end - begin, name)); } }
+                    ((_BNF_STD::vector<U>*)up.first)->push_back(U(begin, end - begin, name)); } }
     virtual void _stub_call( const char* begin, const char* end,  const char* name)
         {   if (cntxU) {
                 cntxU->push_back(U(begin, end - begin, name)); } }
 public:
-    _Parser(std::vector<U>* res = 0) :cntxU(res), off(0)
+    _Parser(_BNF_STD::vector<U>* res = 0) :cntxU(res), off(0)
+        {};
+#if defined(BNFLITE_PMR)
+    explicit _Parser(std::pmr::memory_resource* mr, _BNF_STD::vector<U>* res = 0)
+        :_Base(mr), cntxU(res), off(0)
         {};
+#endif
     virtual ~_Parser()
         {};
     void Get_result(U& u)
         { if (cntxU && cntxU->size()) u = cntxU->front(); }
-    template <class W> friend Rule& Bind(Rule& rule, W (*callback)(std::vector<W>&));
+    template <class W> friend Rule& Bind(Rule& rule, W (*callback)(_BNF_STD::vector<W>&));
+};
+
+/* parser with memory accounting of each parse (context stack and result frames) */
+/* e.g. Profile<Calc> prof(&res); Analyze(root, text, prof); then read prof.peak_cntx */
+template <class U> class Profile: public _Parser<U>
+{
+    size_t frame_bytes;
+    size_t cntx_cap;
+    void _sample()
+        {   if (this->cntxV.capacity() != cntx_cap) { cntx_cap = this->cntxV.capacity(); allocs++; } }
+    void _grow(size_t bytes)
+        {   allocs++; frame_bytes += bytes;
+            if (frame_bytes > peak_frames) peak_frames = frame_bytes; }
+protected:
+    virtual int _analyze(_Tie& root, const char* text)
+        {   peak_cntx = peak_frames = allocs = frame_bytes = cntx_cap = 0;
+            int stat = _Parser<U>::_analyze(root, text);
+            _sample(); peak_cntx = this->cntxV.Peak(); return stat; }
+    virtual void _erase(int low, int up = 0)
+        {   _sample(); _Parser<U>::_erase(low, up); }
+    virtual std::pair<void*, int> _pre_call(void* callback)
+        {   _sample();
+            std::pair<void*, int> up = _Parser<U>::_pre_call(callback);
+            if (this->cntxU) _grow(sizeof(_BNF_STD::vector<U>));
+            return up; }
+    virtual void _post_call(std::pair<void*, int> up)
+        {   _sample();
+            if (this->cntxU) frame_bytes -= this->cntxU->capacity() * sizeof(U) + sizeof(_BNF_STD::vector<U>);
+            _Parser<U>::_post_call(up); }
+    virtual void _do_call(std::pair<void*, int> up,
+            void* callback, void* call, const char* begin, const char* end, const char* name)
+        {   _sample();
+            _BNF_STD::vector<U>* frame = (_BNF_STD::vector<U>*)up.first;
+            size_t cap = frame? frame->capacity() : 0;
+            _Parser<U>::_do_call(up, callback, call, begin, end, name);
+            if (frame && frame->capacity() != cap) _grow((frame->capacity() - cap) * sizeof(U)); }
+    virtual void _stub_call(const char* begin, const char* end, const char* name)
+        {   _sample();
+            size_t cap = this->cntxU? this->cntxU->capacity() : 0;
+            _Parser<U>::_stub_call(begin, end, name);
+            if (this->cntxU && this->cntxU->capacity() != cap) _grow((this->cntxU->capacity() - cap) * sizeof(U)); }
+public:
+    size_t peak_cntx;       //  peak number of context stack elements (cntxV), tracked at each push
+    size_t peak_frames;     //  peak bytes of active result frames (excluding user data internals)
+    size_t allocs;          //  observed allocations of context stack and result frames
+    Profile(_BNF_STD::vector<U>* res = 0) :_Parser<U>(res),
+            frame_bytes(0), cntx_cap(0), peak_cntx(0), peak_frames(0), allocs(0)
+        {};
+    template <class P> friend int Analyze(_Tie& root, const char* text, P& parser);
 };
 
+/* completion of interactively typed text (e.g. command lines): what can follow the typed prefix */
+/* e.g. Completion cmpl(root); cmpl.Suggest("scale=320, cr"); then cmpl.words and cmpl.chars */
+/* Tokens failed at the end of the text form the frontier (FIRST sets of what can follow), */
+/* tokens of literal lexems give keywords. Callbacks are not called. Lexem results are kept */
+/* between calls and dropped only if they have read the changed part, so typing re-parses little */
+class Completion: public _Base
+{
+    _Tie* root;
+    Memo cache;
+    std::string text;
+    std::set<const _Tie*> frontier;
+    std::map<const _Tie*, std::pair<const _Tie*, unsigned int> > literals; // token: literal lexem, index
+    void _literals();
+protected:
+    virtual void _eof(const _Tie* token)
+        {   if (mute == 1) frontier.insert(token); } // not in lookahead predicates
+public:
+    struct Word
+    {   std::string text;   // keyword
+        size_t from;        // offset of its typed part, the part from 'from' to the end is typed
+        bool operator<(const Word& w) const
+            {   return from != w.from? from < w.from : text < w.text; }
+    };
+    std::vector<Word> words;            // keywords which can follow or complete the text
+    std::bitset<maxCharNum> chars;      // characters which can follow the text
+    std::vector<const char*> tokens;    // names of non-literal tokens which can follow the text
+    explicit Completion(_Tie& root) :root(&root)
+        {   memo = &cache; cache.reuse = true; mute = 1; observer = 0; _literals(); }
+    // parse prefix and collect suggestions, return status of Analyze for the prefix
+    int Suggest(const char* prefix)
+        {   size_t same = 0;
+            while (same < text.size() && prefix[same] == text[same])
+                same++;
+            cache.Edit(same);   // keep lexems which have not read the changed part or the previous end
+            text = prefix;
+            frontier.clear(); words.clear(); chars.reset(); tokens.clear();
+            int stat = _run(*root, text.c_str(), 0);
+            std::set<Word> found;
+            for (std::set<const _Tie*>::iterator itr = frontier.begin(); itr != frontier.end(); ++itr) {
+                chars |= static_cast<const Token*>(*itr)->match;
+                std::map<const _Tie*, std::pair<const _Tie*, unsigned int> >::iterator lit = literals.find(*itr);
+                if (lit == literals.end()) {
+                    tokens.push_back((*itr)->name.c_str()); continue; }
+                Word word;
+                word.text = lit->second.first->name;
+                word.from = text.size() - lit->second.second;
+                found.insert(word); }
+            words.assign(found.begin(), found.end());
+            return stat; }
+    // forget memoized results (e.g. after grammar changes)
+    void Reset()
+        {   cache.Clear(); text.clear(); }
+};
+
+inline void Completion::_literals()
+{   std::set<const _Tie*> seen; std::vector<const _Tie*> stack(1, root);
+    while (stack.size()) {
+        const _Tie* tie = stack.back(); stack.pop_back();
+        if (!tie || !seen.insert(tie).second)
+            continue;
+        stack.insert(stack.end(), tie->use.begin(), tie->use.end());
+        if (!dynamic_cast<const Lexem*>(tie) || tie->use.size() != 1 || !tie->use[0])
+            continue;
+        const _Tie* body = tie->use[0];  // Lexem("literal") is a conjunction of single char tokens
+        std::vector<const _Tie*> chain;
+        if (dynamic_cast<const Token*>(body)) chain.push_back(body);
+        else if (dynamic_cast<const _And*>(body)) chain = std::vector<const _Tie*>(body->use.begin(), body->use.end());
+        bool literal = chain.size() == tie->name.size();
+        for (unsigned int i = 0; literal && i < chain.size(); i++) {
+            const Token* tkn = dynamic_cast<const Token*>(chain[i]);
+            literal = tkn && tkn->match[(unsigned char)tie->name[i]] && tkn->match.count() <= 2; }
+        for (unsigned int i = 0; literal && i < chain.size(); i++) {
+            literals[chain[i]] = std::make_pair(tie, i); } } }
+
 /* User interface template to support the second kind of callback */
 /* like: Interface<Foo> CallBack(std::vector<Interface<Foo>>& res); */
 /* The user has to specify own 'Data' abstract type to work with this template */
@@ -637,7 +1322,7 @@ template <typename Data = bool> struct Interface
     Interface(const char* text, size_t length,  const char* name)
         :data(0), text(text), length(length), name(name)
         {}; //  mandatory default constructor to be called from library
-    Interface(Data data, std::vector<Interface>& res, const char* name = "")
+    Interface(Data data, _BNF_STD::vector<Interface>& res, const char* name = "")
         :data(data), text(res.size()? res[0].text: ""),
           length(res.size()? res[res.size() - 1].text
             - res[0].text + res[res.size() - 1].length : 0), name(name)
@@ -647,32 +1332,62 @@ template <typename Data = bool> struct Interface
         {}; // constructor to pass data from user's callback to library
     Interface(): data(0), text(0), length(0), name(0)
         {}; // default constructor
-    static Interface ByPass(std::vector<Interface>& res) // simplest user callback example
+    static Interface ByPass(_BNF_STD::vector<Interface>& res) // simplest user callback example
         {   return res.size()? res[0]: Interface(); }   // just to pass data to upper level
 };
 
 
 /* Start parsing with supporting the first kind of callback only (faster) */
 inline int Analyze(_Tie& root, const char* text, const char** pstop)
-    {   _Base base; return base._analyze(root, text) | base.Get_tail(pstop); }
+    {   _Base base; return base._run(root, text, pstop); }
 
 /* Start parsing with supporting both kinds of callback */
 template <class U> inline int Analyze(_Tie& root, const char* text, const char** pstop, U& u)
-    {   std::vector<U> v; _Parser<U> parser(&v);
-        int stat = parser._analyze(root, text);
+    {   _BNF_STD::vector<U> v; _Parser<U> parser(&v);
+        int stat = parser._run(root, text, pstop);
         parser.Get_result(u);
-        return stat | parser.Get_tail(pstop); }
+        return stat; }
+
+#if defined(BNFLITE_PMR)
+/* Start parsing with both kinds of callback, all parser containers are allocated from 'mr' */
+template <class U> inline int Analyze(_Tie& root, const char* text, const char** pstop, U& u,
+        std::pmr::memory_resource* mr)
+    {   _BNF_STD::vector<U> v(mr); _Parser<U> parser(mr, &v);
+        int stat = parser._run(root, text, pstop);
+        parser.Get_result(u);
+        return stat; }
+#endif
 
 /* Start custom parsing, use getPStop and getResult to obtain results */
 template <class P> inline int Analyze(_Tie& root, const char* text, P& parser)
-    {   return parser._analyze(root, text) | parser.Get_tail(0); }
+    {   return parser._run(root, text, 0); }
+
+/* Start parsing with the first kind of callback receiving user context (one per parse) */
+template <class C> inline int Analyze(_Tie& root, const char* text, const char** pstop, C* context)
+    {   _Base base; base.Set_context(context); return base._run(root, text, pstop); }
+
+/* Start parsing with both kinds of callback receiving user context (one per parse) */
+template <class U, class C> inline int Analyze(_Tie& root, const char* text, const char** pstop, U& u,
+        C* context)
+    {   _BNF_STD::vector<U> v; _Parser<U> parser(&v);
+        parser.Set_context(context);
+        int stat = parser._run(root, text, pstop);
+        parser.Get_result(u);
+        return stat; }
 
 
 /* Create association between Rule and user's callback */
-template <class U> inline Rule& Bind(Rule& rule, U (*callback)(std::vector<U>&))
-    {   rule.callback = reinterpret_cast<void*>(callback); return rule; }
-template <class U> inline Rule& Rule::operator[](U (*callback)(std::vector<U>&)) // for C++11
-    {   this->callback = reinterpret_cast<void*>(callback); return *this; }
+template <class U> inline Rule& Bind(Rule& rule, U (*callback)(_BNF_STD::vector<U>&))
+    {   rule.callback = reinterpret_cast<void*>(callback); rule.call = 0; rule.type = 0; return rule; }
+template <class U> inline Rule& Rule::operator[](U (*callback)(_BNF_STD::vector<U>&)) // for C++11
+    {   return Bind(*this, callback); }
+/* Create association between Rule and user's callback with context (not called without the context) */
+template <class U, class C> inline Rule& Bind(Rule& rule, U (*callback)(_BNF_STD::vector<U>&, C&))
+    {   rule.callback = reinterpret_cast<void*>(callback);
+        rule.call = reinterpret_cast<void*>(&_Call<C>::template rule<U>);
+        rule.type = _type_of<C>(); return rule; }
+template <class U, class C> inline Rule& Rule::operator[](U (*callback)(_BNF_STD::vector<U>&, C&))
+    {   return Bind(*this, callback); }
 
 
 }; // bnf::
@@ -0,0 +1,324 @@
+
+/*************************************************************************\
+*   BNF Lite is a C++ template library for lightweight grammar parsers    *
+*   Copyright (c) 2017 by Alexander A. Semjonov.  ALL RIGHTS RESERVED.    *
+*                                                                         *
+*   This program is free software: you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation, either version 3 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+
+#ifndef BNFLITE_ABNF_H
+#define BNFLITE_ABNF_H
+
+#include "bnflite.h"
+
+namespace bnf
+{
+// Runtime loader of ABNF grammars (RFC 5234, RFC 7405 for %s and %i strings):
+//      Grammar abnf;
+//      int stat = abnf.Load("number = 1*DIGIT [\".\" 1*DIGIT]\n", &stop);
+//      Bind(*abnf["number"], DoNumber);
+//      stat = abnf.Analyze("number", "3.14", &tail, result);
+// ABNF elements are mapped the same way as in C++ notation:
+//  - every ABNF rule is a Rule, found by name (case insensitive) to bind callbacks;
+//  - "string" is a case insensitive Lexem, %x41-5A ranges are Tokens;
+//  - a / b is disjunction, a b is conjunction, <a>*<b>element and [element] are cycles;
+//  - core rules (ALPHA, DIGIT, CRLF, etc.) are added if they are used but not defined.
+// ABNF has no implicit white space, so parse with Verbatim parsers (Grammar::Analyze does).
+// Prose values <...> can not be executed and are rejected as eBadRule.
+
+/* parser which does not skip white space between tokens */
+template <class P = _Base> class Verbatim: public P
+{
+public:
+    Verbatim()
+        {};
+    template <class A> explicit Verbatim(A a) :P(a)
+        {};
+    virtual const char* zero_parse(const char* ptr)
+        {   return ptr; }
+};
+
+/* ABNF grammar loaded at run-time, it owns all elements of loaded rules */
+class Grammar
+{
+    struct _Info
+    {   Rule* rule;
+        std::vector<_Tie*> alts;    // alternatives of "=" and "=/" definitions
+        const char* ref;            // first reference to report undefined rule
+    };
+    std::map<std::string, _Info> rules;
+    std::vector<Rule*> defined;     // rules in order of definitions
+    std::vector<_Tie*> made;        // elements of the current load in creation order
+    const char* ptr;
+    const char* err;
+    int stat;
+    static std::string _lower(const char* name, size_t len)
+        {   std::string str(name, len);
+            for (size_t i = 0; i < len; i++) {
+                if (str[i] >= 'A' && str[i] <= 'Z') str[i] += 'a' - 'A'; }
+            return str; }
+    static bool _alpha(char c)
+        {   return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'); }
+    static bool _digit(char c)
+        {   return c >= '0' && c <= '9'; }
+    static const char* _skip(const char* p) // *c-wsp: spaces, comments and line continuations
+        {   for (;;) {
+                if (*p == ' ' || *p == '\t') {
+                    p++; }
+                else if (*p == ';') {
+                    while (*p && *p != '\n' && *p != '\r') p++; }
+                else if (*p == '\n' || *p == '\r') {
+                    const char* q = p + (p[0] == '\r' && p[1] == '\n'? 2 : 1);
+                    if (*q != ' ' && *q != '\t')
+                        return p;
+                    p = q; }
+                else {
+                    return p; } } }
+    _Tie* _fail(int status = eError|eSyntax)
+        {   if (!err) { err = ptr; stat = status; }
+            return 0; }
+    template <class T> _Tie* _make(const T& tmp)
+        {   T* t = new T(tmp); made.push_back(t); return t; }
+    _Tie* _keep(_Tie* t)
+        {   made.push_back(t); return t; }
+    _Info& _rule(const char* name, size_t len)
+        {   _Info& info = rules[_lower(name, len)];
+            if (!info.rule) {
+                info.rule = new Rule();
+                info.rule->setName(std::string(name, len).c_str());
+                info.ref = name; }
+            return info; }
+    _Tie* _range(unsigned int fst, unsigned int lst)
+        {   if (lst > 0xFF || fst > lst)
+                return _fail();
+            Token* tkn = new Token((char)lst); // NUL terminates the text and is never matched
+            if (fst < lst) tkn->Add(fst? fst : 1, lst);
+            if (!lst) tkn->Remove(0);
+            return _keep(tkn); }
+    bool _number(int base, unsigned int& val)
+        {   const char* org = ptr; val = 0;
+            for (;; ptr++) {
+                int d = _digit(*ptr)? *ptr - '0' : _alpha(*ptr)? (*ptr | 0x20) - 'a' + 10 : base;
+                if (d >= base || val > 0xFFFF)
+                    break;
+                val = val * base + d; }
+            return ptr != org; }
+    _Tie* _numval()  // %x41, %x41-5A, %x0D.0A
+        {   int base = (*ptr | 0x20) == 'x'? 16 : (*ptr | 0x20) == 'd'? 10 : (*ptr | 0x20) == 'b'? 2 : 0;
+            unsigned int fst, lst;
+            if (!base || (++ptr, !_number(base, fst)))
+                return _fail();
+            if (*ptr == '-') {
+                ptr++;
+                if (!_number(base, lst))
+                    return _fail();
+                return _range(fst, lst); }
+            _Tie* res = _range(fst, fst);
+            if (!res || *ptr != '.')
+                return res;
+            _And* seq = 0;
+            while (*ptr == '.') {
+                ptr++;
+                _Tie* next = _number(base, fst)? _range(fst, fst) : _fail();
+                if (!next)
+                    return 0;
+                if (seq) { *seq + *next; }
+                else { res = seq = static_cast<_And*>(_make(*res + *next)); } }
+            return res; }
+    _Tie* _charval(bool ci) // "literal"
+        {   const char* org = ++ptr;
+            while (*ptr && *ptr != '"' && *ptr != '\n' && *ptr != '\r') ptr++;
+            if (*ptr != '"')
+                return _fail();
+            std::string lit(org, ptr++);
+            if (!lit.size())
+                return _keep(new Null());
+            return _keep(new Lexem(lit.c_str(), ci)); }
+    _Tie* _element()
+        {   const char* org = ptr;
+            if (_alpha(*ptr)) {
+                while (_alpha(*ptr) || _digit(*ptr) || *ptr == '-' || *ptr == '_') ptr++;
+                return _rule(org, ptr - org).rule; }
+            if (*ptr == '(' || *ptr == '[') {
+                char close = *ptr == '('? ')' : ']';
+                ptr = _skip(ptr + 1);
+                _Tie* res = _alternation();
+                if (!res)
+                    return 0;
+                ptr = _skip(ptr);
+                if (*ptr++ != close)
+                    return ptr--, _fail();
+                return close == ')'? res : _make(!*res); }
+            if (*ptr == '"')
+                return _charval(true);
+            if (*ptr == '%') {
+                ptr++;
+                if ((*ptr | 0x20) == 's' && ptr[1] == '"') { ptr++; return _charval(false); }
+                if ((*ptr | 0x20) == 'i' && ptr[1] == '"') { ptr++; return _charval(true); }
+                return _numval(); }
+            return _fail(*ptr == '<'? eError|eBadRule : eError|eSyntax); }
+    _Tie* _repetition() // [<a>*<b>]element
+        {   unsigned int min = 1, max = 1;
+            if (_digit(*ptr)) {
+                _number(10, min); max = min; }
+            else if (*ptr == '*') {
+                min = 0; }
+            if (*ptr == '*') {
+                ptr++;
+                if (!_digit(*ptr) || !_number(10, max)) max = maxIterate;
+                if (*ptr == '*' || max < min) return _fail(); }
+            _Tie* res = _element();
+            if (!res || (min == 1 && max == 1))
+                return res;
+            return _make((*res)(min, max)); }
+    _Tie* _concatenation()
+        {   _Tie* res = _repetition();
+            _And* seq = 0;
+            for (const char* p = _skip(ptr); res && p != ptr && (_alpha(*p) || (*p && strchr("0123456789*([\"%<", *p))); p = _skip(ptr)) {
+                ptr = p;
+                _Tie* next = _repetition();
+                if (!next)
+                    return 0;
+                if (seq) { *seq + *next; }
+                else { res = seq = static_cast<_And*>(_make(*res + *next)); } }
+            return res; }
+    _Tie* _alternation()
+        {   _Tie* res = _concatenation();
+            _Or* alt = 0;
+            for (const char* p = _skip(ptr); res && *p == '/'; p = _skip(ptr)) {
+                ptr = _skip(p + 1);
+                _Tie* next = _concatenation();
+                if (!next)
+                    return 0;
+                if (alt) { *alt | *next; }
+                else { res = alt = static_cast<_Or*>(_make(*res | *next)); } }
+            return res; }
+    bool _rulelist(const char* text, bool core)
+        {   for (ptr = text; ; ) {
+                for (;;) { // empty lines and comments
+                    ptr = _skip(ptr);
+                    if (*ptr == '\r' || *ptr == '\n') { ptr++; continue; }
+                    break; }
+                if (!*ptr)
+                    return true;
+                const char* name = ptr;
+                while (_alpha(*ptr) || _digit(*ptr) || *ptr == '-' || *ptr == '_') ptr++;
+                if (ptr == name || !_alpha(*name))
+                    return _fail(), false;
+                size_t len = ptr - name;
+                if (core) { // add used but not defined core rules only
+                    std::map<std::string, _Info>::iterator itr = rules.find(_lower(name, len));
+                    if (itr == rules.end() || itr->second.alts.size()) {
+                        while (*ptr && *ptr != '\n') ptr++;
+                        continue; } }
+                ptr = _skip(ptr);
+                if (*ptr++ != '=')
+                    return ptr--, _fail(), false;
+                if (*ptr == '/') ptr++;
+                ptr = _skip(ptr);
+                _Tie* body = _alternation();
+                if (!body)
+                    return false;
+                _Info& info = _rule(name, len);
+                if (!info.alts.size()) defined.push_back(info.rule);
+                info.alts.push_back(body);
+                ptr = _skip(ptr);
+                if (*ptr && *ptr != '\n' && *ptr != '\r')
+                    return _fail(), false; } }
+    static const char* _core()
+        {   return  "ALPHA = %x41-5A / %x61-7A\n" "BIT = \"0\" / \"1\"\n" "CHAR = %x01-7F\n"
+                    "CR = %x0D\n" "CRLF = CR LF\n" "CTL = %x00-1F / %x7F\n" "DIGIT = %x30-39\n"
+                    "DQUOTE = %x22\n" "HEXDIG = DIGIT / \"A\" / \"B\" / \"C\" / \"D\" / \"E\" / \"F\"\n"
+                    "HTAB = %x09\n" "LF = %x0A\n" "LWSP = *(WSP / CRLF WSP)\n" "OCTET = %x00-FF\n"
+                    "SP = %x20\n" "VCHAR = %x21-7E\n" "WSP = SP / HTAB\n"; }
+    bool _link()
+        {   for (bool more = true; more; ) {  // core rules can use other core rules
+                more = false;
+                for (std::map<std::string, _Info>::iterator itr = rules.begin(); itr != rules.end(); ++itr) {
+                    if (!itr->second.alts.size() && _is_core(itr->first)) more = true; }
+                if (more && !_rulelist(_core(), true))
+                    return false; }
+            for (std::map<std::string, _Info>::iterator itr = rules.begin(); itr != rules.end(); ++itr) {
+                _Info& info = itr->second;
+                if (!info.alts.size()) {
+                    ptr = info.ref; _fail(eError|eBadRule);
+                    return false; }
+                if (info.alts.size() == 1) {
+                    *info.rule = *info.alts[0];
+                    continue; }
+                _Or* alt = static_cast<_Or*>(_make(*info.alts[0] | *info.alts[1]));
+                for (size_t i = 2; i < info.alts.size(); i++) {
+                    *alt | *info.alts[i]; }
+                *info.rule = *alt; }
+            return true; }
+    static bool _is_core(const std::string& name)
+        {   std::string core = _lower(_core(), strlen(_core()));
+            size_t pos = core.find(name + " =");
+            return pos != std::string::npos && (!pos || core[pos - 1] == '\n'); }
+public:
+    Grammar() :ptr(0), err(0), stat(0)
+        {};
+    ~Grammar()
+        {   Clear(); }
+    // load rules from ABNF text replacing the previous ones, returns eOk or eError with
+    // eSyntax (bad ABNF) or eBadRule (undefined rule or prose value), pstop points to the error
+    int Load(const char* text, const char** pstop = 0)
+        {   Clear();
+            err = 0; stat = eOk;
+            if (_rulelist(text, false) && _link()) {
+                for (size_t i = 0; i < made.size(); i++) {
+                    made[i]->inner = true; } // elements are owned by rules from now on
+                made.clear(); }
+            else {
+                ptr = err;
+                Clear(); }
+            if (pstop) *pstop = stat == eOk? text + strlen(text) : err;
+            return stat; }
+    void Clear()
+        {   for (size_t i = defined.size(); i-- > 0; ) {
+                *defined[i] = Null(); } // break recursion, release owned elements (latest first)
+            for (std::map<std::string, _Info>::iterator itr = rules.begin(); itr != rules.end(); ++itr) {
+                if (!itr->second.alts.size()) *itr->second.rule = Null(); }
+            for (size_t i = made.size(); i-- > 0; ) {
+                delete made[i]; }
+            made.clear();
+            for (std::map<std::string, _Info>::iterator itr = rules.begin(); itr != rules.end(); ++itr) {
+                delete itr->second.rule; }
+            rules.clear(); defined.clear(); }
+    // find rule by name (case insensitive) to bind callbacks or to start parsing, 0 if absent
+    Rule* operator[](const char* name)
+        {   std::map<std::string, _Info>::iterator itr = rules.find(_lower(name, strlen(name)));
+            return itr == rules.end()? 0 : itr->second.rule; }
+    size_t Size() const
+        {   return rules.size(); }
+    // parse text against named rule without skipping white space, first kind of callback only
+    int Analyze(const char* name, const char* text, const char** pstop = 0)
+        {   Rule* root = (*this)[name];
+            if (!root)
+                return eError|eBadRule;
+            Verbatim<> parser;
+            return bnf::Analyze(*root, text, parser) | parser.Get_tail(pstop); }
+    // parse text against named rule without skipping white space, both kinds of callback
+    template <class U> int Analyze(const char* name, const char* text, const char** pstop, U& u)
+        {   Rule* root = (*this)[name];
+            if (!root)
+                return eError|eBadRule;
+            _BNF_STD::vector<U> v; Verbatim<_Parser<U> > parser(&v);
+            int stat = bnf::Analyze(*root, text, parser) | parser.Get_tail(pstop);
+            parser.Get_result(u);
+            return stat; }
+};
+
+}; // bnf::
+#endif // BNFLITE_ABNF_H
@@ -0,0 +1,178 @@
+
+/*************************************************************************\
+*   BNF Lite is a C++ template library for lightweight grammar parsers    *
+*   Copyright (c) 2017 by Alexander A. Semjonov.  ALL RIGHTS RESERVED.    *
+*                                                                         *
+*   This program is free software: you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation, either version 3 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+
+#ifndef BNFLITE_CACHE_H
+#define BNFLITE_CACHE_H
+
+#include "bnflite.h"
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace bnf
+{
+// Optional result cache in front of Analyze (C++11) for highly repetitive inputs
+// like command lines: the same text parsed against the same root rule gives
+// the same status, stop offset and result, so the parse can be skipped.
+//      Cache<Calc> cache(1 << 20);  // about 1MB of cached inputs and results
+//      int stat = cache.Analyze(Expression, text, &tail, result);
+// Inputs are hashed (fast, non-cryptographic) and then compared byte-by-byte.
+// Note: callbacks are NOT invoked on hits, so cache only side-effect free grammars;
+// the 'text' member of the cached result is rebased to the new input,
+// any other pointers kept in the user data must stay valid by themselves.
+
+/* 64-bit hash of the input bytes and the grammar root, 8 bytes per step */
+inline unsigned long long _Hash(const char* text, size_t len, const void* root)
+{   const unsigned long long m = 0x9E3779B97F4A7C15ULL;
+    unsigned long long h = (unsigned long long)(size_t)root * m ^ len;
+    for (; len >= 8; len -= 8, text += 8) {
+        unsigned long long k; memcpy(&k, text, 8);
+        h = (h ^ (k * m)) * 0xFF51AFD7ED558CCDULL; h ^= h >> 32; }
+    if (len) {
+        unsigned long long k = 0; memcpy(&k, text, len);
+        h = (h ^ (k * m)) * 0xFF51AFD7ED558CCDULL; }
+    h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ULL; h ^= h >> 33;
+    return h; }
+
+template <class U = Interface<> > class Cache
+{
+    struct Entry
+    {   unsigned long long hash;
+        const _Tie* root;
+        std::string text;
+        int stat;
+        size_t stop;        //  offset of the unparsed text
+        bool results;       //  parsed with the second kind of callback
+        bool valued;        //  the parse gave a result, it is stored
+        long off;           //  offset of result text in the input or -1
+        U res;
+        size_t bytes() const
+            {   return sizeof(Entry) + text.capacity(); }
+    };
+    typedef typename std::list<Entry>::iterator Itr;
+    struct Shard
+    {   std::mutex lock;
+        std::list<Entry> lru;   // most recently used first
+        std::unordered_multimap<unsigned long long, Itr> map;
+        size_t bytes, hits, misses, evictions;
+        Shard(): bytes(0), hits(0), misses(0), evictions(0)
+            {};
+    };
+    std::vector<Shard> shards;
+    size_t limit;   // bytes per shard
+    static unsigned int _pow2(unsigned int n)
+        {   unsigned int i = 1;
+            while (i < n) i <<= 1;
+            return i; }
+    Shard& _shard(unsigned long long hash)
+        {   return shards[(hash >> 48) & (shards.size() - 1)]; }
+    static Itr _find(Shard& sh, unsigned long long hash, const _Tie* root, const char* text, size_t len)
+        {   auto rng = sh.map.equal_range(hash);
+            for (auto itr = rng.first; itr != rng.second; ++itr) {
+                Entry& e = *itr->second;
+                if (e.root == root && e.text.size() == len && !memcmp(e.text.data(), text, len)) {
+                    return itr->second; } }
+            return sh.lru.end(); }
+    static void _remove(Shard& sh, Itr e)
+        {   auto rng = sh.map.equal_range(e->hash);
+            for (auto itr = rng.first; itr != rng.second; ++itr) {
+                if (itr->second == e) { sh.map.erase(itr); break; } }
+            sh.bytes -= e->bytes();
+            sh.lru.erase(e); }
+    bool _lookup(_Tie& root, const char* text, size_t len, unsigned long long hash,
+            const char** pstop, U* u, int& stat)
+        {   Shard& sh = _shard(hash);
+            std::lock_guard<std::mutex> guard(sh.lock);
+            Itr e = _find(sh, hash, &root, text, len);
+            if (e == sh.lru.end() || (u && !e->results)) {
+                sh.misses++; return false; }
+            sh.hits++;
+            sh.lru.splice(sh.lru.begin(), sh.lru, e);
+            if (pstop) *pstop = text + e->stop;
+            if (u && e->valued) { *u = e->res; if (e->off >= 0) u->text = text + e->off; }
+            stat = e->stat;
+            return true; }
+    void _store(_Tie& root, const char* text, size_t len, unsigned long long hash,
+            const char* stop, bool results, const U* u, int stat)
+        {   Shard& sh = _shard(hash);
+            std::lock_guard<std::mutex> guard(sh.lock);
+            Itr e = _find(sh, hash, &root, text, len);
+            if (e != sh.lru.end()) {
+                _remove(sh, e); }
+            sh.lru.push_front(Entry());
+            Entry& n = sh.lru.front();
+            n.hash = hash; n.root = &root; n.text.assign(text, len);
+            n.stat = stat; n.stop = stop - text; n.results = results; n.valued = u != 0; n.off = -1;
+            if (u) {
+                n.res = *u;
+                if (u->text >= text && u->text <= text + len) n.off = u->text - text; }
+            sh.map.insert(std::make_pair(hash, sh.lru.begin()));
+            for (sh.bytes += n.bytes(); sh.bytes > limit && sh.lru.size() > 1; sh.evictions++) {
+                _remove(sh, --sh.lru.end()); } }
+public:
+    struct Counters
+    {   size_t hits, misses, evictions, entries, bytes;
+        double HitRate() const
+            {   return hits + misses? (double)hits / (hits + misses) : 0; }
+    };
+    // capacity is the total byte budget, shards is rounded up to a power of two
+    explicit Cache(size_t capacity = 1 << 20, unsigned int shards = 16)
+        :shards(_pow2(shards)), limit(capacity / _pow2(shards))
+        {};
+    // same as bnf::Analyze(root, text, pstop) but may return the cached status and stop
+    int Analyze(_Tie& root, const char* text, const char** pstop = 0)
+        {   size_t len = strlen(text); int stat;
+            unsigned long long hash = _Hash(text, len, &root);
+            if (_lookup(root, text, len, hash, pstop, 0, stat))
+                return stat;
+            const char* stop = 0;
+            stat = bnf::Analyze(root, text, &stop);
+            _store(root, text, len, hash, stop, false, 0, stat);
+            if (pstop) *pstop = stop;
+            return stat; }
+    // same as bnf::Analyze(root, text, pstop, u) but may return the cached result
+    int Analyze(_Tie& root, const char* text, const char** pstop, U& u)
+        {   size_t len = strlen(text); int stat;
+            unsigned long long hash = _Hash(text, len, &root);
+            if (_lookup(root, text, len, hash, pstop, &u, stat))
+                return stat;
+            _BNF_STD::vector<U> v; _Parser<U> parser(&v);
+            const char* stop = 0;
+            stat = bnf::Analyze(root, text, parser);
+            parser.Get_tail(&stop);
+            if (v.size()) u = v.front();    // u is left as is if there is no result, like bnf::Analyze does
+            _store(root, text, len, hash, stop, true, v.size()? &u : 0, stat);
+            if (pstop) *pstop = stop;
+            return stat; }
+    Counters Stats()
+        {   Counters cnt = {0, 0, 0, 0, 0};
+            for (size_t i = 0; i < shards.size(); i++) {
+                std::lock_guard<std::mutex> guard(shards[i].lock);
+                cnt.hits += shards[i].hits; cnt.misses += shards[i].misses;
+                cnt.evictions += shards[i].evictions;
+                cnt.entries += shards[i].lru.size(); cnt.bytes += shards[i].bytes; }
+            return cnt; }
+    void Clear()
+        {   for (size_t i = 0; i < shards.size(); i++) {
+                std::lock_guard<std::mutex> guard(shards[i].lock);
+                shards[i].map.clear(); shards[i].lru.clear(); shards[i].bytes = 0; } }
+};
+
+}; // bnf::
+#endif // BNFLITE_CACHE_H
@@ -0,0 +1,286 @@
+
+/*************************************************************************\
+*   BNF Lite is a C++ template library for lightweight grammar parsers    *
+*   Copyright (c) 2017 by Alexander A. Semjonov.  ALL RIGHTS RESERVED.    *
+*                                                                         *
+*   This program is free software: you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation, either version 3 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+
+#ifndef BNFLITE_STAT_H
+#define BNFLITE_STAT_H
+
+#include "bnflite.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+namespace bnf
+{
+// Optional production statistics of parses (C++11), observers of Analyze calls:
+//      Metrics metrics;
+//      Observe(&metrics);   // all parsers, or parser.observer = &metrics
+//      ...
+//      std::string text = metrics.Export(); // e.g. for local scraping
+// Metrics keep latency and throughput histograms and failure counts per root rule.
+// Each thread records into own shard, shards are merged on demand.
+//      Capture capture("/var/tmp/bnf", Capture::Thresholds(500, 50), "http");
+//      parser.observer = &capture;  // or Observe(&capture)
+// Capture saves inputs parsed too slowly (per byte) or with too many steps for replay.
+
+/* log-linear histogram (like HDR one), 16 sub-buckets per power of two (~6% resolution) */
+class Histogram
+{
+public:
+    enum { nSub = 16, nBuckets = 61 * nSub };
+    unsigned long long count;
+    unsigned long long max;
+    unsigned long long bucket[nBuckets];
+    static unsigned int Index(unsigned long long v)
+        {   if (v < nSub)
+                return (unsigned int)v;
+            unsigned int e = 0;
+            for (unsigned int s = 32; s; s >>= 1) {
+                if (v >> s >> e) e += s; }
+            return (e - 3) * nSub + ((v >> (e - 4)) & (nSub - 1)); }
+    static unsigned long long Value(unsigned int idx) // middle of the bucket
+        {   if (idx < nSub)
+                return idx;
+            unsigned int e = idx / nSub + 3;
+            return ((unsigned long long)(nSub + idx % nSub) << (e - 4)) + ((1ULL << (e - 4)) >> 1); }
+    Histogram()
+        {   Clear(); }
+    void Clear()
+        {   count = max = 0; memset(bucket, 0, sizeof(bucket)); }
+    void Record(unsigned long long v)
+        {   bucket[Index(v)]++; count++;
+            if (v > max) max = v; }
+    void Merge(const Histogram& h)
+        {   for (unsigned int i = 0; i < nBuckets; i++) {
+                bucket[i] += h.bucket[i]; }
+            count += h.count;
+            if (h.max > max) max = h.max; }
+    // value at quantile q (0...1), e.g. Percentile(0.99)
+    unsigned long long Percentile(double q) const
+        {   unsigned long long rank = (unsigned long long)(q * count + 0.5), sum = 0;
+            for (unsigned int i = 0; i < nBuckets; i++) {
+                sum += bucket[i];
+                if (sum >= rank && sum)
+                    return std::min(Value(i), max); }
+            return max; }
+};
+
+/* per root rule metrics of parses */
+class Metrics: public Observer
+{
+public:
+    enum { nStatus = 8 };
+    static unsigned int StatusBit(unsigned int i)
+        {   static const unsigned int bits[nStatus] = { eOk, eEof, eRest, eOver, eBadRule, eBadLexem, eSyntax, eError };
+            return bits[i]; }
+    // eOk is kept by syntax errors found after a part of the text has been parsed
+    static bool Failed(int stat)
+        {   return !(stat & eOk) || (stat & (eError|eRest|eOver|eBadRule|eBadLexem)); }
+    static const char* StatusName(unsigned int i)
+        {   static const char* names[nStatus] = { "fail", "eEof", "eRest", "eOver", "eBadRule", "eBadLexem", "eSyntax", "eError" };
+            return names[i]; }
+    struct Series
+    {   std::string name;       // name of the root rule
+        unsigned long long parses, bytes;
+        unsigned long long failures[nStatus]; // failed parses ("fail") and status bits of them
+        Histogram latency;      // ns
+        Histogram rate;         // parsed bytes per second
+        Series(): parses(0), bytes(0)
+            {   memset(failures, 0, sizeof(failures)); }
+        void Merge(const Series& s)
+            {   if (name.empty()) name = s.name;
+                parses += s.parses; bytes += s.bytes;
+                for (unsigned int i = 0; i < nStatus; i++) {
+                    failures[i] += s.failures[i]; }
+                latency.Merge(s.latency); rate.Merge(s.rate); }
+    };
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Shard
+    {   std::mutex lock;    // taken by the owner thread and by merges only
+        std::map<const _Tie*, Series> series;
+    };
+    std::mutex lock;
+    std::vector<std::unique_ptr<Shard> > shards;
+    unsigned long long id;
+    static std::vector<Clock::time_point>& _starts()
+        {   static thread_local std::vector<Clock::time_point> starts; return starts; }
+    Shard& _shard()
+        {   static thread_local std::map<unsigned long long, Shard*> mine;
+            Shard*& shard = mine[id];
+            if (!shard) {
+                std::lock_guard<std::mutex> guard(lock);
+                shards.emplace_back(new Shard);
+                shard = shards.back().get(); }
+            return *shard; }
+public:
+    Metrics()
+        {   static std::atomic<unsigned long long> ids(0); id = ++ids; }
+    virtual void Enter(const _Base& parser, _Tie& root, const char* text)
+        {   _starts().push_back(Clock::now()); }
+    virtual void Leave(const _Base& parser, _Tie& root, const char* text, const char* stop, int stat)
+        {   unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - _starts().back()).count();
+            _starts().pop_back();
+            unsigned long long len = stop && stop > text? stop - text : 0;
+            Shard& sh = _shard();
+            std::lock_guard<std::mutex> guard(sh.lock);
+            Series& s = sh.series[&root];
+            if (s.name.empty()) s.name = root.getName();
+            s.parses++; s.bytes += len;
+            if (Failed(stat)) {
+                for (unsigned int i = 0; i < nStatus; i++) {
+                    s.failures[i] += i? (stat & StatusBit(i)) != 0 : 1; } }
+            s.latency.Record(ns);
+            s.rate.Record(len * 1000000000ULL / (ns? ns : 1)); }
+    // merged metrics of all threads for the root rule
+    Series Get(const _Tie& root)
+        {   Series res;
+            std::lock_guard<std::mutex> guard(lock);
+            for (size_t i = 0; i < shards.size(); i++) {
+                std::lock_guard<std::mutex> sg(shards[i]->lock);
+                std::map<const _Tie*, Series>::iterator itr = shards[i]->series.find(&root);
+                if (itr != shards[i]->series.end()) res.Merge(itr->second); }
+            return res; }
+    // merged metrics of all threads for all root rules
+    std::map<const _Tie*, Series> Snapshot()
+        {   std::map<const _Tie*, Series> res;
+            std::lock_guard<std::mutex> guard(lock);
+            for (size_t i = 0; i < shards.size(); i++) {
+                std::lock_guard<std::mutex> sg(shards[i]->lock);
+                for (std::map<const _Tie*, Series>::iterator itr = shards[i]->series.begin();
+                        itr != shards[i]->series.end(); ++itr) {
+                    res[itr->first].Merge(itr->second); } }
+            return res; }
+    void Clear()
+        {   std::lock_guard<std::mutex> guard(lock);
+            for (size_t i = 0; i < shards.size(); i++) {
+                std::lock_guard<std::mutex> sg(shards[i]->lock);
+                shards[i]->series.clear(); } }
+    // text exposition of merged metrics, one "name{labels} value" per line
+    std::string Export()
+        {   static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+            std::map<const _Tie*, Series> snap = Snapshot();
+            std::string out; char buf[64];
+            for (std::map<const _Tie*, Series>::iterator itr = snap.begin(); itr != snap.end(); ++itr) {
+                const Series& s = itr->second;
+                std::string grammar = "{grammar=\"";
+                for (size_t i = 0; i < s.name.size(); i++) {
+                    char c = s.name[i];
+                    if (c == '"' || c == '\\') grammar += '\\';
+                    grammar += c == '\n'? 'n' : c; }
+                grammar += '"';
+                snprintf(buf, sizeof(buf), "} %llu\n", s.parses);
+                out += "bnf_parses_total" + grammar + buf;
+                snprintf(buf, sizeof(buf), "} %llu\n", s.bytes);
+                out += "bnf_parsed_bytes_total" + grammar + buf;
+                for (unsigned int i = 0; i < nStatus; i++) {
+                    snprintf(buf, sizeof(buf), "\"} %llu\n", s.failures[i]);
+                    out += "bnf_parse_failures_total" + grammar + ",status=\"" + StatusName(i) + buf; }
+                for (unsigned int i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+                    snprintf(buf, sizeof(buf), ",quantile=\"%g\"} %llu\n", quantiles[i], s.latency.Percentile(quantiles[i]));
+                    out += "bnf_parse_latency_ns" + grammar + buf;
+                    snprintf(buf, sizeof(buf), ",quantile=\"%g\"} %llu\n", quantiles[i], s.rate.Percentile(quantiles[i]));
+                    out += "bnf_parse_bytes_per_second" + grammar + buf; } }
+            return out; }
+};
+
+/* capture of slow or over-budget inputs into files for offline replay */
+class Capture: public Observer
+{
+public:
+    struct Thresholds
+    {   double ns_per_byte;     // latency per byte of input, 0 - not checked
+        double steps_per_byte;  // visits of tokens, lexems and rules per byte of input, 0 - not checked
+        unsigned long steps;    // step budget of one parse, 0 - not checked
+        explicit Thresholds(double ns_per_byte = 0, double steps_per_byte = 0, unsigned long steps = 0)
+            :ns_per_byte(ns_per_byte), steps_per_byte(steps_per_byte), steps(steps)
+            {};
+    };
+    std::atomic<unsigned long long> captured;   // saved inputs
+    std::atomic<unsigned long long> dropped;    // inputs over thresholds but not saved (rate, size, i/o)
+private:
+    typedef std::chrono::steady_clock Clock;
+    std::string dir;
+    std::string id;
+    Thresholds limits;
+    unsigned int per_second;
+    size_t max_bytes;
+    std::mutex lock;
+    Clock::time_point window;
+    unsigned int used;
+    std::atomic<unsigned long long> seq;
+    static std::vector<Clock::time_point>& _starts()
+        {   static thread_local std::vector<Clock::time_point> starts; return starts; }
+    bool _allow() // at most per_second captures in each second
+        {   std::lock_guard<std::mutex> guard(lock);
+            Clock::time_point now = Clock::now();
+            if (now - window >= std::chrono::seconds(1)) {
+                window = now; used = 0; }
+            return used < per_second? ++used, true : false; }
+    bool _save(const _Base& parser, _Tie& root, const char* text, size_t len,
+            const char* stop, int stat, unsigned long long ns, const char* reason)
+        {   char name[64];
+            snprintf(name, sizeof(name), "/%llu-%llu", (unsigned long long)std::chrono::duration_cast<
+                std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count(), ++seq);
+            std::string path = dir + name;
+            FILE* in = fopen((path + ".in").c_str(), "wb");
+            if (!in)
+                return false;
+            bool ok = fwrite(text, 1, len, in) == len;
+            ok = !fclose(in) && ok;
+            FILE* meta = fopen((path + ".meta").c_str(), "w");
+            if (!meta)
+                return false;
+            fprintf(meta, "grammar %s\nroot %s\nstatus 0x%x\nbytes %lu\nparsed %lu\nns %llu\nsteps %lu\nreason %s\n",
+                id.size()? id.c_str() : root.getName(), root.getName(), stat, (unsigned long)len,
+                (unsigned long)(stop && stop > text? stop - text : 0), ns, parser.steps, reason);
+            return !fclose(meta) && ok; }
+public:
+    // dir - existing directory for <time>-<n>.in inputs and <time>-<n>.meta sidecars,
+    // id - grammar id for replay (name of the root rule by default)
+    Capture(const char* dir, const Thresholds& limits, const char* id = "",
+            unsigned int per_second = 1, size_t max_bytes = 1 << 20)
+        :captured(0), dropped(0), dir(dir), id(id), limits(limits), per_second(per_second),
+         max_bytes(max_bytes), window(Clock::now()), used(0), seq(0)
+        {};
+    virtual void Enter(const _Base& parser, _Tie& root, const char* text)
+        {   _starts().push_back(Clock::now()); }
+    virtual void Leave(const _Base& parser, _Tie& root, const char* text, const char* stop, int stat)
+        {   unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - _starts().back()).count();
+            _starts().pop_back();
+            // the input is what the parse has read (a record of a larger buffer is not scanned to its end)
+            const char* end = parser.reach && *parser.reach? parser.reach + 1 : parser.reach;
+            if (stop && stop > end) end = stop;
+            size_t len = end && end > text? end - text : 0;
+            double bytes = len? (double)len : 1;
+            const char* reason = 0;
+            if (limits.steps && parser.steps > limits.steps) reason = "steps";
+            else if (limits.steps_per_byte && parser.steps / bytes > limits.steps_per_byte) reason = "steps_per_byte";
+            else if (limits.ns_per_byte && ns / bytes > limits.ns_per_byte) reason = "ns_per_byte";
+            if (!reason)
+                return;
+            if (len > max_bytes || !_allow() || !_save(parser, root, text, len, stop, stat, ns, reason)) {
+                dropped++; return; }
+            captured++; }
+};
+
+}; // bnf::
+#endif // BNFLITE_STAT_H
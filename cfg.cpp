@@ -23,8 +23,11 @@ struct client
      vector< pair< string,  string> > prop;
 };
 
-vector <struct client> Cfg;  // client configuration container 
-string tmpstr;
+struct config // parsing context instead of global variables
+{
+     vector <struct client> clients;  // client configuration container 
+     string tmpstr;
+};
 
 
 static bool printMsg(const char* lexem, size_t len)
@@ -33,28 +36,28 @@ static bool printMsg(const char* lexem, size_t len)
     return true; // should retuirn true to continue parsing
 }
 
-static bool addkey(const char* lexem, size_t len)
+static bool addkey(config& cfg, const char* lexem, size_t len)
 {   
-    Cfg.resize(Cfg.size() + 1);
-    Cfg.back().key = string(lexem + 1, len - 2);
+    cfg.clients.resize(cfg.clients.size() + 1);
+    cfg.clients.back().key = string(lexem + 1, len - 2);
     return true;
 }
 
-static bool addmail(const char* lexem, size_t len)
+static bool addmail(config& cfg, const char* lexem, size_t len)
 {   
-    Cfg.back().mail = string(lexem + 1, len - 2);
+    cfg.clients.back().mail = string(lexem + 1, len - 2);
     return true;
 }
 
-static bool addtype(const char* lexem, size_t len)
+static bool addtype(config& cfg, const char* lexem, size_t len)
 {   
-    tmpstr = string(lexem + 1, len - 2);
+    cfg.tmpstr = string(lexem + 1, len - 2);
     return true;
 }
 
-static bool addlimit(const char* lexem, size_t len)
+static bool addlimit(config& cfg, const char* lexem, size_t len)
 {   
-    Cfg.back().prop.push_back(make_pair(tmpstr, string(lexem + 1, len - 2)));
+    cfg.clients.back().prop.push_back(make_pair(cfg.tmpstr, string(lexem + 1, len - 2)));
     return true;
 }
 
@@ -74,26 +77,27 @@ int main()
     Lexem _client = Token("<") + Token("/") + client  +">";
     Lexem _end = Token("/") +">";
 
-    Rule xclient = Token("<") + client  + key  + "=" + quotedvalue + addkey
-                                        + mail + "=" + quotedvalue + addmail + ">";
-    Rule xalert = Token("<") + alert  + type + "=" + quotedvalue + addtype
-                                                + limit + "=" +  quotedvalue + addlimit + _end;
+    Rule xclient = Token("<") + client  + key  + "=" + quotedvalue + Action(addkey)
+                                        + mail + "=" + quotedvalue + Action(addmail) + ">";
+    Rule xalert = Token("<") + alert  + type + "=" + quotedvalue + Action(addtype)
+                                                + limit + "=" +  quotedvalue + Action(addlimit) + _end;
 
     Rule xclient1 = xclient + printMsg;
     Rule xalert1 = xalert + printMsg;
    
     Rule root = *(xclient  + *(xalert) + _client);
     
+    config Cfg;
     const char* tail = 0;
-    int tst = Analyze(root, xml, &tail);
+    int tst = Analyze(root, xml, &tail, &Cfg);
     if (tst > 0)
-        cout << "Clients configured: " << Cfg.size()  << endl;
+        cout << "Clients configured: " << Cfg.clients.size()  << endl;
     else
         cout << "Parsing errors detected, status = " << hex << tst << endl
          << "stopped at: " << tail << endl;
 
 
-    for (vector<struct client>::iterator j = Cfg.begin(); j != Cfg.end(); ++j) {
+    for (vector<struct client>::iterator j = Cfg.clients.begin(); j != Cfg.clients.end(); ++j) {
         cout << "Client " << j->key << " has " << (*j).prop.size() << " properties: "; 
         for (vector<pair<string, string> >::iterator i = j->prop.begin(); i != j->prop.end(); ++i) {
             cout << i->first << "="  << i->second <<"; ";
@@ -20,6 +20,7 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <atomic>
 #include <functional>
 #include <algorithm>
 #include <iostream>
@@ -30,7 +31,11 @@ enum OpCode
     opInt = 1,  opFloat = 2,  opStr = 3,  opMaskType = 0x03,
     opError = 1, opNeg = 2, opPos = 3, opCall = 4,
     opToInt = 5,  opToFloat = 6, opToStr = 7,
-    opAdd = 2,  opSub = 3,  opMul = 4,  opDiv = 5,
+    opAdd = 2,  opSub = 3,  opMul = 4,  opDiv = 5, opCoalesce = 6,
+    opLookup = 32, opRandom = 33, opColumn = 34, /* OP2 codes above OP3 ones */
+    opMulAdd = 35, opMulSub = 36, opAddMul = 37, opSubMul = 38, /* fused: a*b+c, a*b-c, c+a*b, c-a*b */
+    opPowN = 39, opShr = 40, /* x^val_i by multiplications, x / 2^val_i by shift */
+    opSet = 41, opGet = 42, /* pop to and push from local slot val_i (arguments of inlined functions) */
 };
 
 #define OP3(scd, fst, op)  (OpCode) ( ((op) << 4) | ((fst) << 2) | ((scd) << 0) )
@@ -40,6 +45,8 @@ enum OpCode
 #define CP2(l, op, r) ( (((l) & 0xF) << 16) | (((r) & 0xF) << 12) | ((op) & 0x7F) )
 
 #define MAX_PARAM_NUM 3
+#define MAX_LOCAL_NUM 16
+#define MAX_TABLE_NUM 64
 #define PRM(r, p1, p2, p3) ( (((p3) & 3) << 6) | (((p2) & 3) << 4) | (((p1) & 3) << 2) | ((r) & 3) )
 
 struct byte_code
@@ -75,6 +82,11 @@ typedef std::list<byte_code> script;
 extern std::list<byte_code> GenCallOp(std::string name, std::vector<std::list<byte_code> > args);
 extern std::list<byte_code> GenUnaryOp(char op, std::list<byte_code> unr);
 extern std::list<byte_code> GenBinaryOp(std::list<byte_code> left, char op, std::list<byte_code> right);
+extern std::list<byte_code> GenLookupOp(std::string table, std::list<byte_code> index);
+extern std::list<byte_code> GenRandomOp(std::string name, std::vector<std::list<byte_code> > args);
+extern std::list<byte_code> GenColumnOp(int column);
+extern std::list<byte_code> GenCoalesceOp(std::vector<std::list<byte_code> > args);
+extern bool IsBuiltIn(std::string name);
 
 struct FuncTable
 {
@@ -89,9 +101,71 @@ struct FuncTable
 
 extern struct FuncTable GFunTable[];
 extern size_t GFunTableSize;
+void PrepareCall(FuncTable& fun);
 
+struct LookupTable  // named numeric table for LOOKUP(table, index), not changed once registered
+{
+    std::string name;
+    std::vector<float> values;
+};
+
+extern LookupTable GLookupTables[MAX_TABLE_NUM];
+extern std::atomic<size_t> GLookupTableSize;  /* tables below it are filled, compiles and evaluations read them */
+/* add a table (may run while other threads compile or evaluate), returns its index
+   or -1 if the name is registered already, values are empty or there is no room */
+int RegisterTable(std::string name, const float* values, size_t size);
+
+struct Diagnostic   // compilation message of bulk compilation
+{
+    size_t program;     // index of program (identical formulas share one program)
+    int status;         // bnf status of parsing or eError
+    size_t offset;      // position in the formula
+    std::string message;
+};
+
+struct BulkProgram
+{
+    std::vector<int> program_of;    // program index of each formula
+    std::vector<std::list<byte_code> > programs;
+    std::vector<Diagnostic> diagnostics;
+};
+
+enum OptFlags { optFuse = 1, optReduce = 2, optFastMath = 4 };
+extern int GOptimize;   /* passes of OptimizeBC, optFastMath allows inexact reciprocals */
+struct UserFunction // def NAME(a, b) = expression, inlined into callers
+{
+    std::string name;
+    std::vector<std::string> params;
+    std::string body;
+};
+
+extern std::vector<UserFunction> GUserFunctions;
+/* add user function to the library, returns its index or -1 (with diagnostics) for a bad definition,
+   a built-in name or another definition of a defined name (the same one is accepted again);
+   it may run while other threads compile, bulk compiles inline the functions defined before the call */
+int DefineFunction(std::string def, std::vector<Diagnostic>* diagnostics = 0);
+
+std::list<byte_code> OptimizeBC(std::list<byte_code> bc);    /* lowering passes of code_opt.cpp */
 std::list<byte_code> spirit_byte_code(std::string expr);
 std::list<byte_code> bnflite_byte_code(std::string expr);
-int EvaluateBC(std::list<byte_code> bc, void* res);
+/* compile formulas in parallel (threads = 0 - by hardware), returns the number of failed programs */
+int bnflite_bulk_compile(const std::vector<std::string>& formulas, BulkProgram& bulk, unsigned int threads = 0);
+/* lanes are rows row..row+3, bit l of errors is set if lane l failed (integer division by zero,
+   invalid integer conversion, NaN), such lanes are zeroed and the others are still computed */
+int EvaluateBC(std::list<byte_code> bc, void* res, int row = 0, unsigned int* errors = 0);
+/* rows results of 4 bytes each and bitmap of erroneous rows ((rows + 7) / 8 bytes) */
+int EvaluateRows(std::list<byte_code> bc, void* res, int rows, unsigned char* errors, int row = 0);
+
+struct Columns  // float input columns $0, $1, ... of EvaluateColumns
+{
+    int rows;
+    std::vector<const float*> values;
+    std::vector<const unsigned char*> validity; // Arrow-style bitmaps (bit set - valid), absent or 0 - no nulls
+};
+
+/* nulls propagate through operations and calls (COALESCE takes the first non-null argument),
+   validity bitmap of results is filled in the same pass, errors of null rows are not reported */
+int EvaluateColumns(std::list<byte_code> bc, const Columns& in, void* res, unsigned char* validity,
+    unsigned char* errors = 0);
 
 #endif //_BYTE_CODE_H
@@ -68,11 +68,103 @@ std::list<byte_code> GenBinaryOp(std::list<byte_code> left, char op, std::list<b
 }
 
 
+std::list<byte_code> GenLookupOp(std::string table, std::list<byte_code> index)
+{
+    std::list<byte_code> all;
+    size_t num = GLookupTableSize;
+    for (unsigned int i = 0; i < num; i++) {
+        if (table != GLookupTables[i].name)
+            continue;
+        all.splice(all.end(), index);
+        if (byte_code::toType(all.back().type) == opFloat)
+            all.push_back(byte_code(OP2(opFloat, opToInt)));
+        else if (byte_code::toType(all.back().type) != opInt)
+            break;
+        all.push_back(byte_code(OP2(opFloat, opLookup), (signed)i));
+        return all;
+    }
+    all.clear();
+    all.push_back(byte_code(OP2(opFloat, opError), (signed)num));
+    return all;
+}
+
+
+std::list<byte_code> GenRandomOp(std::string name, std::vector<std::list<byte_code> > args)
+{   /* RAND(stream) - uniform in [0, 1), RANDN(stream) - standard normal */
+    std::list<byte_code> all;
+    if (args.size() != 1 || !args[0].size()) {
+        all.push_back(byte_code(OP2(opFloat, opError), 0));
+        return all;
+    }
+    all.splice(all.end(), args[0]);
+    if (byte_code::toType(all.back().type) == opFloat)
+        all.push_back(byte_code(OP2(opFloat, opToInt)));
+    all.push_back(byte_code(OP2(opFloat, opRandom), name == "RANDN"));
+    return all;
+}
+
+
+std::list<byte_code> GenColumnOp(int column)
+{   /* $column - float input column */
+    return std::list<byte_code>(1, byte_code(OP2(opFloat, opColumn), column));
+}
+
+
+std::list<byte_code> GenCoalesceOp(std::vector<std::list<byte_code> > args)
+{   /* COALESCE(a, b, ...) - the first non-null argument, ints are converted if any argument is float */
+    std::list<byte_code> all;
+    int type = opInt;
+    bool bad = !args.size();
+    for (unsigned int j = 0; j < args.size() && !bad; j++) {
+        bad = !args[j].size() || byte_code::toType(args[j].back().type) == opStr;
+        if (!bad && byte_code::toType(args[j].back().type) == opFloat)
+            type = opFloat;
+    }
+    if (bad) {
+        all.push_back(byte_code(OP2(opFloat, opError), 0));
+        return all;
+    }
+    for (unsigned int j = 0; j < args.size(); j++) {
+        all.splice(all.end(), args[j]);
+        if (type == opFloat && byte_code::toType(all.back().type) == opInt)
+            all.push_back(byte_code(OP2(opInt, opToFloat)));
+        if (j > 0)
+            all.push_back(byte_code(OP3(type, type, opCoalesce)));
+    }
+    return all;
+}
+
+
+bool IsBuiltIn(std::string name)
+{
+    if (name == "RAND" || name == "RANDN" || name == "COALESCE" || name == "LOOKUP")
+        return true;
+    for (size_t i = 1; i < GFunTableSize; i++) {
+        if (name == GFunTable[i].name)
+            return true;
+    }
+    return false;
+}
+
+static bool PrepareCalls()
+{
+    for (size_t i = 0; i < GFunTableSize; i++)
+        PrepareCall(GFunTable[i]);
+    return true;
+}
+
 std::list<byte_code> GenCallOp(std::string name, std::vector<std::list<byte_code> > args)
 {
+    static const bool prepared = PrepareCalls();  // once for all parsing threads, then only read
+    (void)prepared;
     unsigned int i, j;
     std::list<byte_code> all;
 
+    if (name == "RAND" || name == "RANDN")
+        return GenRandomOp(name, args);
+    if (name == "COALESCE")
+        return GenCoalesceOp(args);
+
     for (i = 0; i < GFunTableSize; i++) {
         if (name != GFunTable[i].name)
             continue;
@@ -90,15 +182,23 @@ std::list<byte_code> GenCallOp(std::string name, std::vector<std::list<byte_code
             all.splice(all.end(), args[j]);
         }
         all.push_back(byte_code(OP2(GFunTable[i].ret & opMaskType, opCall), (signed)i));
-        GFunTable[i].num = j;
-        GFunTable[i].call_idx = PRM(GFunTable[i].ret,
-            GFunTable[i].param[0], GFunTable[i].param[1], GFunTable[i].param[2]);
         return all;
     }
     all.push_back(byte_code(OP2(opInt, opError), (signed)i));
     return all;
 }
 
+void PrepareCall(FuncTable& fun)
+{   /* number of parameters and calling index for the interpreter; written once, then only read */
+    int num = 0, idx = PRM(fun.ret, fun.param[0], fun.param[1], fun.param[2]);
+    while (num < MAX_PARAM_NUM && fun.param[num])
+        num++;
+    if (fun.num != num || fun.call_idx != idx) {
+        fun.num = num;
+        fun.call_idx = idx;
+    }
+}
+
 std::ostream& operator<<(std::ostream& out, const byte_code& bc)
 {
     switch (bc.type) {
@@ -113,12 +213,24 @@ std::ostream& operator<<(std::ostream& out, const byte_code& bc)
             case opToInt: out << "opToInt<"; break;
             case opToFloat: out << "opToFloat<"; break;
             case opToStr: out << "opToStr<"; break;
+            case opLookup: out << "opLookup(" << bc.val_i << ")<"; break;
+            case opRandom: out << (bc.val_i? "opRandN<" : "opRand<"); break;
+            case opColumn: out << "opColumn(" << bc.val_i << ")<"; break;
+            case opMulAdd: out << "opMulAdd<"; break;
+            case opMulSub: out << "opMulSub<"; break;
+            case opAddMul: out << "opAddMul<"; break;
+            case opSubMul: out << "opSubMul<"; break;
+            case opPowN: out << "opPowN(" << bc.val_i << ")<"; break;
+            case opShr: out << "opShr(" << bc.val_i << ")<"; break;
+            case opSet: out << "opSet(" << bc.val_i << ")<"; break;
+            case opGet: out << "opGet(" << bc.val_i << ")<"; break;
             default:
                 switch (bc.type >> 4) {
                     case opAdd: out << "opAdd<"; break;
                     case opSub: out << "opSub<"; break;
                     case opMul: out << "opMul<"; break;
                     case opDiv: out << "opDiv<"; break;
+                    case opCoalesce: out << "opCoalesce<"; break;
                     default: out << "Error<"; break;
                 }
                 out << byte_code::pType((bc.type >>2) & opMaskType) << ',';
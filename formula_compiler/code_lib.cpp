@@ -16,6 +16,7 @@
 \****************************************************************************/
 #include "byte_code.h"
 #include "math.h"
+#include <mutex>
 
 
 static int GetX()
@@ -59,4 +60,31 @@ struct FuncTable GFunTable[] = {
 size_t GFunTableSize = sizeof(GFunTable) / sizeof(GFunTable[0]);
 
 
+LookupTable GLookupTables[MAX_TABLE_NUM];
+std::atomic<size_t> GLookupTableSize(0);
+
+int RegisterTable(std::string name, const float* values, size_t size)
+{   /* compiled programs keep indexes of tables, so tables are only appended and never changed */
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+    size_t num = GLookupTableSize;
+    if (!size || num == MAX_TABLE_NUM)
+        return -1;
+    for (size_t i = 0; i < num; i++) {
+        if (name == GLookupTables[i].name)
+            return -1;
+    }
+    GLookupTables[num].name = name;
+    GLookupTables[num].values.assign(values, values + size);
+    GLookupTableSize = num + 1;    // publish the filled table
+    return num;
+}
+
+static const float Squares[] = { 0, 1, 4, 9, 16, 25, 36, 49, 64, 81 };
+static const float Rates[] = { 0.5f, 1.5f, 2.5f, 4.0f };
+static int registered = // static examples, e.g. LOOKUP(SQUARES, 3)
+    RegisterTable("SQUARES", Squares, sizeof(Squares) / sizeof(Squares[0])) +
+    RegisterTable("RATES", Rates, sizeof(Rates) / sizeof(Rates[0]));
+
+
 
@@ -0,0 +1,157 @@
+/****************************************************************************\
+*   Byte-code optimizer part of formula compiler (based on BNFLite)          *
+*   Copyright (c) 2017  Alexander A. Semjonov <alexander.as0@mail.ru>        *
+*                                                                            *
+*   Permission to use, copy, modify, and distribute this software for any    *
+*   purpose with or without fee is hereby granted, provided that the above   *
+*   copyright notice and this permission notice appear in all copies.        *
+*                                                                            *
+*   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES *
+*   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF         *
+*   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR  *
+*   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES   *
+*   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN    *
+*   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF  *
+*   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.           *
+\****************************************************************************/
+
+#include "byte_code.h"
+#include <math.h>
+#include <string.h>
+
+int GOptimize = optFuse | optReduce;
+
+
+static bool IsFloatOp(const byte_code& bc, int op)
+{
+    return bc.type == OP3(opFloat, opFloat, op);
+}
+
+static int StackEffect(const byte_code& bc)
+{   /* number of values pushed (or popped if negative) by the byte-code */
+    if (bc.type <= opMaskType)
+        return 1;                                   // Int, Float, Str
+    if (bc.type < OP3(0, 0, opAdd)) {
+        switch (bc.type >> 2) {
+        case opError: return 1;
+        case opCall: return 1 - GFunTable[bc.val_i].num;
+        default: return 0;                          // unary operations and conversions
+        }
+    }
+    if (bc.type < OP2(0, opLookup))
+        return -1;                                  // binary operations
+    switch (bc.type >> 2) {
+    case opColumn: case opGet: return 1;
+    case opSet: return -1;
+    case opMulAdd: case opMulSub: case opAddMul: case opSubMul: return -2;
+    default: return 0;                              // opLookup, opRandom
+    }
+}
+
+static int Operand(const std::vector<byte_code>& v, int end)
+{   /* start of the operand which value is pushed by the byte-code at end */
+    for (int k = end, n = 0; k >= 0; k--) {
+        if ((n += StackEffect(v[k])) == 1)
+            return k;
+    }
+    return -1;
+}
+
+static int Constant(const std::vector<byte_code>& v, int end, float& value)
+{   /* length of Float(c) or Int(c) opToFloat<I> operand at end, 0 if it is not a constant */
+    if (end >= 0 && v[end].type == opFloat) {
+        value = v[end].val_f;
+        return 1;
+    }
+    if (end >= 1 && v[end].type == OP2(opInt, opToFloat) && v[end - 1].type == opInt) {
+        value = (float)v[end - 1].val_i;
+        return 2;
+    }
+    return 0;
+}
+
+static int Log2(int c)
+{   /* k if c is 2^k, -1 otherwise */
+    if (c <= 0 || (c & (c - 1)))
+        return -1;
+    int k = 0;
+    while (c >>= 1)
+        k++;
+    return k;
+}
+
+static void Replace(std::vector<byte_code>& v, int from, int to, const byte_code* with, int n)
+{
+    v.erase(v.begin() + from, v.begin() + to + 1);
+    v.insert(v.begin() + from, with, with + n);
+}
+
+static void ReduceStrength(std::vector<byte_code>& v)
+{   /* POW(x, n) -> opPowN(n), x / c -> x * (1/c), i / 2^k -> opShr(k) */
+    for (int p = 1; p < (int)v.size(); p++) {
+        float c;
+        int len, k;
+        if (v[p].type == OP3(opFloat, opFloat, opDiv) && (len = Constant(v, p - 1, c)) && c != 0 && isfinite(c)) {
+            int exp;
+            float r = 1 / c;
+            if (isnormal(r) && (fabsf(frexpf(c, &exp)) == 0.5f || (GOptimize & optFastMath))) {
+                byte_code mul[] = { byte_code(opFloat, r), byte_code(OP3(opFloat, opFloat, opMul)) };
+                Replace(v, p - len, p, mul, 2);
+                p -= len - 1;
+            }
+        } else if (v[p].type == OP3(opInt, opInt, opDiv) && v[p - 1].type == opInt && (k = Log2(v[p - 1].val_i)) >= 0) {
+            byte_code shr(OP2(opInt, opShr), k);
+            Replace(v, p - 1, p, &shr, k > 0);  // i / 1 is dropped
+            p -= 1 + !k;
+        } else if ((v[p].type >> 2) == opCall && v[p].type < OP3(0, 0, opAdd)) {
+            const FuncTable& fun = GFunTable[v[p].val_i];
+            int n;
+            if (strcmp(fun.name, "POW") || fun.num != 2)
+                continue;
+            if (v[p - 1].type == opInt && fun.param[1] == opInt)
+                n = v[p - 1].val_i;
+            else if (v[p - 1].type == opFloat && fun.param[1] == opFloat && isfinite(v[p - 1].val_f)
+                    && fabsf(v[p - 1].val_f) <= 64 && v[p - 1].val_f == (int)v[p - 1].val_f)   // in range before the cast
+                n = (int)v[p - 1].val_f;
+            else
+                continue;
+            if (n < -64 || n > 64)
+                continue;
+            int ret = fun.ret & opMaskType;
+            byte_code pow[] = { byte_code(OP2(opInt, opToFloat)), byte_code(OP2(ret, opPowN), n) };
+            bool conv = ret == opFloat && fun.param[0] == opInt;
+            Replace(v, p - 1, p, pow + !conv, 1 + conv);
+            p -= !conv;
+        }
+    }
+}
+
+static void FuseMultiplyAdd(std::vector<byte_code>& v)
+{   /* c + a*b: c a b opMul opAdd -> c a b opAddMul, a*b + c: a b opMul c opAdd -> a b c opMulAdd */
+    for (int p = 1; p < (int)v.size(); p++) {
+        bool add = IsFloatOp(v[p], opAdd);
+        if (!add && !IsFloatOp(v[p], opSub))
+            continue;
+        if (IsFloatOp(v[p - 1], opMul)) {
+            v[p] = byte_code(OP2(opFloat, add? opAddMul : opSubMul));
+            v.erase(v.begin() + --p);
+            continue;
+        }
+        int right = Operand(v, p - 1);
+        if (right > 0 && IsFloatOp(v[right - 1], opMul)) {
+            v[p] = byte_code(OP2(opFloat, add? opMulAdd : opMulSub));
+            v.erase(v.begin() + right - 1);
+            p--;
+        }
+    }
+}
+
+std::list<byte_code> OptimizeBC(std::list<byte_code> bc)
+{
+    std::vector<byte_code> v(bc.begin(), bc.end());
+    if (GOptimize & optReduce)
+        ReduceStrength(v);
+    if (GOptimize & optFuse)
+        FuseMultiplyAdd(v);
+    return std::list<byte_code>(v.begin(), v.end());
+}
@@ -16,15 +16,209 @@
 \****************************************************************************/
 
 #include "byte_code.h"
+#include <math.h>
 
 
 #include <immintrin.h>
 #include <emmintrin.h>
 
-int EvaluateBC(std::list<byte_code> bc, void* res)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TARGET(isa) __attribute__((target(isa)))
+#define CPU_SUPPORTS(isa) __builtin_cpu_supports(isa)
+#else
+#define TARGET(isa)
+#define CPU_SUPPORTS(isa) 0
+#endif
+
+static __m128i ClampIndex(__m128i idx, int size)
+{   // idx = min(max(idx, 0), size - 1) without SSE4.1 min/max
+    __m128i hi = _mm_set1_epi32(size - 1);
+    __m128i over = _mm_cmpgt_epi32(idx, hi);
+    idx = _mm_or_si128(_mm_and_si128(over, hi), _mm_andnot_si128(over, idx));
+    return _mm_andnot_si128(_mm_cmplt_epi32(idx, _mm_setzero_si128()), idx);
+}
+
+TARGET("avx2") static __m128 GatherAVX2(const float* table, __m128i idx)
+{
+    return _mm_i32gather_ps(table, idx, 4);
+}
+
+TARGET("ssse3") static __m128 ShuffleSSSE3(__m128 table, __m128i idx)
+{   // tiny table in one register: byte indexes 4*idx + {0,1,2,3}
+    __m128i bytes = _mm_mullo_epi16(idx, _mm_set1_epi32(0x0404));
+    bytes = _mm_add_epi8(_mm_or_si128(bytes, _mm_slli_epi32(bytes, 16)), _mm_set1_epi32(0x03020100));
+    return _mm_castsi128_ps(_mm_shuffle_epi8(_mm_castps_si128(table), bytes));
+}
+
+TARGET("fma") static __m128 MulAddFMA3(__m128 a, __m128 b, __m128 c)
+{
+    return _mm_fmadd_ps(a, b, c);
+}
+
+static __m128 Fused(int op, __m128 x, __m128 y, __m128 z)
+{   // x*y+z, x*y-z, x+y*z, x-y*z with one rounding if the CPU has FMA3
+    static const bool fma = CPU_SUPPORTS("fma");
+    __m128 sign = _mm_set_ps1(-0.0f);
+    __m128 a = x, b = y, c = z;
+    switch (op) {
+    case opMulSub: c = _mm_xor_ps(z, sign); break;
+    case opAddMul: a = y; b = z; c = x; break;
+    case opSubMul: a = _mm_xor_ps(y, sign); b = z; c = x; break;
+    }
+    return fma? MulAddFMA3(a, b, c) : _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+
+static __m128 PowN(__m128 x, int n)
+{   // square-and-multiply, 1/x^-n for negative n
+    __m128 r = _mm_set_ps1(1.0f);
+    for (unsigned int m = n < 0? -n : n; m; m >>= 1) {
+        if (m & 1)
+            r = _mm_mul_ps(r, x);
+        if (m > 1)
+            x = _mm_mul_ps(x, x);
+    }
+    return n < 0? _mm_div_ps(_mm_set_ps1(1.0f), r) : r;
+}
+
+static __m128i MulLo32(__m128i a, __m128i b)
+{   // low 32 bits of products (wrapped as int multiplication) without SSE4.1
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static __m128i PowN(__m128i x, int n)
+{   // as Pow of code_lib.cpp: 1 for n <= 0
+    __m128i r = _mm_set1_epi32(1);
+    for (unsigned int m = n < 0? 0 : n; m; m >>= 1) {
+        if (m & 1)
+            r = MulLo32(r, x);
+        if (m > 1)
+            x = MulLo32(x, x);
+    }
+    return r;
+}
+
+static __m128i ShiftRound(__m128i x, int k)
+{   // x / 2^k rounded to nearest even as cvtps_epi32 of the quotient in opDiv<I,I>
+    if (!k)
+        return x;
+    __m128i q = _mm_sra_epi32(x, _mm_cvtsi32_si128(k));
+    __m128i r = _mm_and_si128(x, _mm_set1_epi32((1 << k) - 1));
+    __m128i half = _mm_set1_epi32(1 << (k - 1));
+    __m128i odd = _mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1));
+    __m128i up = _mm_or_si128(_mm_cmpgt_epi32(r, half), _mm_and_si128(_mm_cmpeq_epi32(r, half), odd));
+    return _mm_sub_epi32(q, up);
+}
+
+static __m128 Lookup(const LookupTable& table, __m128 index)
+{
+    static const bool avx2 = CPU_SUPPORTS("avx2");
+    static const bool ssse3 = CPU_SUPPORTS("ssse3");
+    const float* values = &table.values[0];
+    int size = table.values.size();
+    __m128i idx = ClampIndex(_mm_castps_si128(index), size);
+    if (size <= 4 && ssse3) {
+        float tiny[4] = { 0, 0, 0, 0 };
+        for (int j = 0; j < size; j++)
+            tiny[j] = values[j];
+        return ShuffleSSSE3(_mm_loadu_ps(tiny), idx);
+    }
+    if (avx2)
+        return GatherAVX2(values, idx);
+    int iX[4];
+    _mm_storeu_si128((__m128i*)iX, idx);
+    return _mm_setr_ps(values[iX[0]], values[iX[1]], values[iX[2]], values[iX[3]]);
+}
+
+static __m128i MulHiLo(__m128i a, unsigned int m, __m128i& lo)
+{   // 32x32->64 products of 4 lanes: lanes 0,2 and 1,3 separately
+    __m128i mm = _mm_set1_epi32(m);
+    __m128i even = _mm_mul_epu32(a, mm);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), mm);
+    lo = _mm_unpacklo_epi64(_mm_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 2, 0)));
+    __m128i hi = _mm_unpackhi_epi64(_mm_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 2, 0)));
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+static void Philox(__m128i c[4])
+{   // Philox4x32-10 counter-based generator, one block per lane (c[k] holds word k of 4 lanes)
+    unsigned int k0 = 0x243F6A88, k1 = 0x85A308D3; // fixed key, streams differ by counter
+    for (int r = 0; r < 10; r++, k0 += 0x9E3779B9, k1 += 0xBB67AE85) {
+        __m128i lo0, lo1;
+        __m128i hi0 = MulHiLo(c[0], 0xD2511F53, lo0);
+        __m128i hi1 = MulHiLo(c[2], 0xCD9E8D57, lo1);
+        c[0] = _mm_xor_si128(_mm_xor_si128(hi1, c[1]), _mm_set1_epi32(k0));
+        c[1] = lo1;
+        c[2] = _mm_xor_si128(_mm_xor_si128(hi0, c[3]), _mm_set1_epi32(k1));
+        c[3] = lo0;
+    }
+}
+
+static __m128 Random(__m128 stream, int row, int site, bool normal)
+{   // counter (row of lane, call site, stream, 0): the same numbers whatever rows are evaluated together
+    __m128i c[4] = { _mm_add_epi32(_mm_set1_epi32(row), _mm_setr_epi32(0, 1, 2, 3)),
+        _mm_set1_epi32(site), _mm_castps_si128(stream), _mm_setzero_si128() };
+    Philox(c);
+    __m128 scale = _mm_set_ps1(1.0f / (1 << 24));
+    __m128 u1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(c[0], 8)), scale);
+    if (!normal)
+        return u1;
+    __m128 u2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(c[1], 8)), scale);
+    float fu1[4], fu2[4];
+    _mm_storeu_ps(fu1, u1);
+    _mm_storeu_ps(fu2, u2);
+    for (int l = 0; l < 4; l++) { // Box-Muller, u1 in (0, 1]
+        fu1[l] = -2.0f * logf(1.0f - fu1[l]);
+        fu2[l] = cosf(6.28318530718f * fu2[l]);
+    }
+    return _mm_mul_ps(_mm_sqrt_ps(_mm_loadu_ps(fu1)), _mm_loadu_ps(fu2));
+}
+
+static __m128i ToInt(__m128 f, __m128i& err)
+{   // cvtps gives 0x80000000 for NaN and out of range values, it is an error unless f is INT_MIN
+    __m128i v = _mm_cvtps_epi32(f);
+    __m128i bad = _mm_cmpeq_epi32(v, _mm_set1_epi32(0x80000000));
+    err = _mm_or_si128(err, _mm_andnot_si128(_mm_castps_si128(_mm_cmpeq_ps(f, _mm_set_ps1(-2147483648.0f))), bad));
+    return v;
+}
+
+static __m128i IsNaN(__m128 f)
+{
+    return _mm_castps_si128(_mm_cmpunord_ps(f, f));
+}
+
+static __m128i NullLanes(const unsigned char* validity, int row)
+{   // validity bit 0 of row means null value
+    if (!validity)
+        return _mm_setzero_si128();
+    int bits = validity[row / 8] >> (row % 8);
+    if (row % 8 > 4)
+        bits |= validity[row / 8 + 1] << (8 - row % 8);
+    return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128());
+}
+
+static __m128 Column(const float* values, int row, int rows)
+{
+    if (row + 4 <= rows)
+        return _mm_loadu_ps(values + row);
+    float tail[4] = { 0, 0, 0, 0 };
+    for (int l = 0; row + l < rows; l++)
+        tail[l] = values[row + l];
+    return _mm_loadu_ps(tail);
+}
+
+static int Evaluate(const std::list<byte_code>& bc, __m128& res, int row, const Columns* in,
+    __m128i& errors, __m128i& nulls)
 {
     __m128   X[16];
+    __m128i  E[16]; // per lane error masks of stack values
+    __m128i  N[16]; // per lane null masks of stack values
+    __m128   LX[MAX_LOCAL_NUM];  // local slots with their masks
+    __m128i  LE[MAX_LOCAL_NUM], LN[MAX_LOCAL_NUM];
     int i = -1;
+    int site = 0;   // random call sites are numbered in byte-code order
 
 	for (const auto &code : bc) {
         switch (code.type) {
@@ -36,9 +230,12 @@ int EvaluateBC(std::list<byte_code> bc, void* res)
 
         case OP1(opInt):
             X[++i] = _mm_castsi128_ps(_mm_set1_epi32(code.val_i));
+            E[i] = N[i] = _mm_setzero_si128();
             break;
        case OP1(opFloat):
             X[++i] = _mm_set_ps1(code.val_f);
+            E[i] = IsNaN(X[i]);
+            N[i] = _mm_setzero_si128();
             break;
         case  OP2(opInt, opNeg):
             X[i] = _mm_castsi128_ps(_mm_sub_epi32(_mm_set1_epi32(0), _mm_castps_si128(X[i])));
@@ -48,38 +245,113 @@ int EvaluateBC(std::list<byte_code> bc, void* res)
             break;
 
         case OP3(opInt, opInt, opAdd):
+            E[i - 1] = _mm_or_si128(E[i - 1], E[i]);
+            N[i - 1] = _mm_or_si128(N[i - 1], N[i]);
             X[i - 1] = _mm_castsi128_ps(_mm_sub_epi32( _mm_castps_si128(X[i - 1]),
                                     _mm_sub_epi32(_mm_set1_epi32(0), _mm_castps_si128(X[i]))));
             i -= 1; break;
         case OP3(opFloat, opFloat, opAdd):
             X[i - 1] = _mm_add_ps(X[i - 1], X[i]);
+            E[i - 1] = _mm_or_si128(_mm_or_si128(E[i - 1], E[i]), IsNaN(X[i - 1]));
+            N[i - 1] = _mm_or_si128(N[i - 1], N[i]);
             i -= 1; break;
         case OP3(opInt, opInt, opSub):
+            E[i - 1] = _mm_or_si128(E[i - 1], E[i]);
+            N[i - 1] = _mm_or_si128(N[i - 1], N[i]);
             X[i - 1] = _mm_castsi128_ps(_mm_sub_epi32(_mm_castps_si128(X[i - 1]), _mm_castps_si128(X[i])));
             i -= 1; break;
         case OP3(opFloat, opFloat, opSub):
             X[i - 1] = _mm_sub_ps(X[i - 1], X[i]);
+            E[i - 1] = _mm_or_si128(_mm_or_si128(E[i - 1], E[i]), IsNaN(X[i - 1]));
+            N[i - 1] = _mm_or_si128(N[i - 1], N[i]);
             i -= 1;  break;
         case OP3(opInt, opInt, opMul):
-            X[i - 1] = _mm_castsi128_ps(_mm_cvtps_epi32(_mm_mul_ps(
-                _mm_cvtepi32_ps(_mm_castps_si128(X[i - 1])),_mm_cvtepi32_ps(_mm_castps_si128(X[i])))));
+            E[i - 1] = _mm_or_si128(E[i - 1], E[i]);
+            N[i - 1] = _mm_or_si128(N[i - 1], N[i]);
+            X[i - 1] = _mm_castsi128_ps(ToInt(_mm_mul_ps(
+                _mm_cvtepi32_ps(_mm_castps_si128(X[i - 1])),_mm_cvtepi32_ps(_mm_castps_si128(X[i]))), E[i - 1]));
             i -= 1; break;
         case OP3(opFloat, opFloat, opMul):
             X[i - 1] = _mm_mul_ps(X[i - 1], X[i]);
+            E[i - 1] = _mm_or_si128(_mm_or_si128(E[i - 1], E[i]), IsNaN(X[i - 1]));
+            N[i - 1] = _mm_or_si128(N[i - 1], N[i]);
             i -= 1; break;
-        case OP3(opInt, opInt, opDiv):
-            X[i - 1] = _mm_castsi128_ps(_mm_cvtps_epi32(_mm_div_ps(
-                _mm_cvtepi32_ps(_mm_castps_si128(X[i - 1])),_mm_cvtepi32_ps(_mm_castps_si128(X[i])))));
-            i -= 1; break;
+        case OP3(opInt, opInt, opDiv): {
+            __m128i zero = _mm_cmpeq_epi32(_mm_castps_si128(X[i]), _mm_setzero_si128());
+            E[i - 1] = _mm_or_si128(_mm_or_si128(E[i - 1], E[i]), zero);
+            N[i - 1] = _mm_or_si128(N[i - 1], N[i]);
+            X[i - 1] = _mm_castsi128_ps(ToInt(_mm_div_ps(_mm_cvtepi32_ps(_mm_castps_si128(X[i - 1])),
+                _mm_cvtepi32_ps(_mm_sub_epi32(_mm_castps_si128(X[i]), zero))), E[i - 1])); // x/0 lanes get x/1
+            i -= 1; break; }
         case OP3(opFloat, opFloat, opDiv):
             X[i - 1] = _mm_div_ps(X[i - 1], X[i]);
+            E[i - 1] = _mm_or_si128(_mm_or_si128(E[i - 1], E[i]), IsNaN(X[i - 1]));
+            N[i - 1] = _mm_or_si128(N[i - 1], N[i]);
             i -= 1; break;
 
+        case OP2(opFloat, opColumn):
+            if (!in || code.val_i >= (int)in->values.size())
+                return -2;
+            X[++i] = Column(in->values[code.val_i], row, in->rows);
+            N[i] = code.val_i < (int)in->validity.size()? NullLanes(in->validity[code.val_i], row) : _mm_setzero_si128();
+            E[i] = IsNaN(X[i]);
+            break;
+
+        case OP3(opInt, opInt, opCoalesce):
+        case OP3(opFloat, opFloat, opCoalesce):   // first value unless it is null
+            X[i - 1] = _mm_or_ps(_mm_andnot_ps(_mm_castsi128_ps(N[i - 1]), X[i - 1]),
+                _mm_and_ps(_mm_castsi128_ps(N[i - 1]), X[i]));
+            E[i - 1] = _mm_or_si128(_mm_andnot_si128(N[i - 1], E[i - 1]), _mm_and_si128(N[i - 1], E[i]));
+            N[i - 1] = _mm_and_si128(N[i - 1], N[i]);
+            i -= 1; break;
+
+        case OP2(opFloat, opMulAdd):
+        case OP2(opFloat, opMulSub):
+        case OP2(opFloat, opAddMul):
+        case OP2(opFloat, opSubMul):
+            X[i - 2] = Fused(code.type >> 2, X[i - 2], X[i - 1], X[i]);
+            E[i - 2] = _mm_or_si128(_mm_or_si128(E[i - 2], E[i - 1]), _mm_or_si128(E[i], IsNaN(X[i - 2])));
+            N[i - 2] = _mm_or_si128(_mm_or_si128(N[i - 2], N[i - 1]), N[i]);
+            i -= 2; break;
+
+        case OP2(opFloat, opPowN):
+            X[i] = PowN(X[i], code.val_i);
+            E[i] = _mm_or_si128(E[i], IsNaN(X[i]));
+            break;
+        case OP2(opInt, opPowN):
+            X[i] = _mm_castsi128_ps(PowN(_mm_castps_si128(X[i]), code.val_i));
+            break;
+        case OP2(opInt, opShr):
+            X[i] = _mm_castsi128_ps(ShiftRound(_mm_castps_si128(X[i]), code.val_i));
+            break;
+
+        case OP2(opInt, opSet):
+        case OP2(opFloat, opSet):
+            LX[code.val_i] = X[i];
+            LE[code.val_i] = E[i];
+            LN[code.val_i] = N[i];
+            i -= 1; break;
+        case OP2(opInt, opGet):
+        case OP2(opFloat, opGet):
+            X[++i] = LX[code.val_i];
+            E[i] = LE[code.val_i];
+            N[i] = LN[code.val_i];
+            break;
+
+        case OP2(opFloat, opRandom):
+            X[i] = Random(X[i], row, site++, code.val_i != 0);
+            E[i] = _mm_or_si128(E[i], IsNaN(X[i]));
+            break;
+
+        case OP2(opFloat, opLookup):
+            X[i] = Lookup(GLookupTables[code.val_i], X[i]);
+            break;
+
         case OP2(opInt, opToFloat):
             X[i] = _mm_cvtepi32_ps(_mm_castps_si128(X[i]));
             break;
         case OP2(opFloat, opToInt):
-            X[i] = _mm_castsi128_ps(_mm_cvtps_epi32(X[i]));
+            X[i] = _mm_castsi128_ps(ToInt(X[i], E[i]));
             break;
 
         case OP2(opInt, opCall):
@@ -89,6 +361,11 @@ int EvaluateBC(std::list<byte_code> bc, void* res)
             int j = code.val_i;
             void (*f)() = (void(*)())GFunTable[j].fun;
             i = i - GFunTable[j].num + 1;
+            __m128i err = _mm_setzero_si128(), null = _mm_setzero_si128();
+            for (int k = 0; k < GFunTable[j].num; k++) {
+                err = _mm_or_si128(err, E[i + k]);
+                null = _mm_or_si128(null, N[i + k]);
+            }
             int (&iX)[][4] =(int(&)[][4])(X[i]);
             float (&fX)[][4] =(float(&)[][4])(X[i]);
 
@@ -119,11 +396,73 @@ int EvaluateBC(std::list<byte_code> bc, void* res)
                     return  -3;
                 }
             }
+            E[i] = (GFunTable[j].ret & opMaskType) == opFloat? _mm_or_si128(err, IsNaN(X[i])) : err;
+            N[i] = null;
             break;
         }
     }
-    *(__m128*)res  =  X[i];
+    if (i < 0)
+        return i;
+    errors = _mm_andnot_si128(N[i], E[i]);     // errors of null lanes are not reported
+    nulls = N[i];
+    res = _mm_andnot_ps(_mm_castsi128_ps(_mm_or_si128(E[i], N[i])), X[i]); // erroneous and null lanes are zeroed
+    return i;
+}
+
+int EvaluateBC(std::list<byte_code> bc, void* res, int row, unsigned int* errors)
+{
+    __m128i err, nulls;
+    int i = Evaluate(bc, *(__m128*)res, row, 0, err, nulls);
+    if (i >= 0 && errors)
+        *errors = _mm_movemask_ps(_mm_castsi128_ps(err));
     return i;
 }
 
+static void SetBits(unsigned char* bitmap, int row, int rows, int lanes)
+{
+    for (int l = 0; l < 4 && row + l < rows; l++) {
+        if (lanes & (1 << l))
+            bitmap[(row + l) / 8] |= 1 << ((row + l) % 8);
+        else
+            bitmap[(row + l) / 8] &= ~(1 << ((row + l) % 8));
+    }
+}
+
+static int EvaluateAll(const std::list<byte_code>& bc, const Columns* in, void* res, int rows,
+    unsigned char* validity, unsigned char* errors, int row)
+{
+    int (*out)[4] = (int(*)[4])res;
+    for (int r = 0; r < rows; r += 4) {
+        __m128 value;
+        __m128i err, nulls;
+        int i = Evaluate(bc, value, row + r, in, err, nulls);
+        if (i)
+            return i;
+        if (r + 4 <= rows)
+            _mm_storeu_ps((float*)out[r / 4], value);
+        else {
+            int lanes[4];
+            _mm_storeu_si128((__m128i*)lanes, _mm_castps_si128(value));
+            for (int l = 0; r + l < rows; l++)
+                out[r / 4][l] = lanes[l];
+        }
+        if (errors)
+            SetBits(errors, r, rows, _mm_movemask_ps(_mm_castsi128_ps(err)));
+        if (validity)
+            SetBits(validity, r, rows, ~_mm_movemask_ps(_mm_castsi128_ps(nulls)));
+    }
+    return 0;
+}
+
+int EvaluateRows(std::list<byte_code> bc, void* res, int rows, unsigned char* errors, int row)
+{
+    return EvaluateAll(bc, 0, res, rows, 0, errors, row);
+}
+
+int EvaluateColumns(std::list<byte_code> bc, const Columns& in, void* res, unsigned char* validity,
+    unsigned char* errors)
+{
+    return EvaluateAll(bc, &in, res, in.rows, validity, errors, 0);
+}
+
 
@@ -23,6 +23,12 @@ int main(int argc, char* argv[])
     for (int i = 1; i < argc; i++) {
         expression += argv[i];
     }
+    for (size_t semi; (semi = expression.find(';')) != std::string::npos; expression.erase(0, semi + 1)) {
+        std::vector<Diagnostic> diagnostics;   /* def NAME(a, b) = expression; ... expression */
+        DefineFunction(expression.substr(0, semi), &diagnostics);
+        for (size_t i = 0; i < diagnostics.size(); i++)
+            std::cout << "definition error: " << diagnostics[i].message << std::endl;
+    }
     if (!expression.size()) {
         std::cout <<  "No expression\n"
         "Use integer/float numbers and functions to make arithmetic expression\n"
@@ -35,6 +41,13 @@ int main(int argc, char* argv[])
                 std::cout << dlim << types[GFunTable[i].param[j] & opMaskType];
             std::cout << ");\n";
         }
+        std::cout << "   RAND(Int); RANDN(Int); (uniform and normal random numbers of the stream)\n";
+        std::cout << "   COALESCE(...); (the first non-null argument, see EvaluateColumns for $0, $1, ... columns)\n";
+        std::cout << "   def NAME(a,b) = expression; ... (user functions inlined into the final expression)\n";
+        std::cout << "   LOOKUP(Table,Int); with tables:";
+        for (size_t i = 0; i < GLookupTableSize; i++)
+            std::cout << " " << GLookupTables[i].name << "[" << GLookupTables[i].values.size() << "]";
+        std::cout << "\n";
         return 1;
     }
 
@@ -45,15 +58,19 @@ int main(int argc, char* argv[])
             std::cout << *itr <<  (itr != (++bl.rbegin()).base()? ",": ";\n");
 
     union { int val_i;  float val_f; } res[4] = {0};
-    int err = EvaluateBC(bl, res);
+    unsigned int errors = 0;
+    int err = EvaluateBC(bl, res, 0, &errors);
     if (err || !bl.size())
         std::cout << "running error: "  << err << std::endl;
     else {
         std::cout << "result = ";
-        for (size_t i = 0; i < sizeof(res)/sizeof(res[0]); i++) 
-            std::cout  << 
-                (byte_code::toType(bl.back().type) == opInt? (float)res[i].val_i: res[i].val_f)
-                       << (i < sizeof(res)/sizeof(res[0]) - 1? ", ": ";\n");
+        for (size_t i = 0; i < sizeof(res)/sizeof(res[0]); i++) {
+            if (errors & (1 << i))
+                std::cout << "error";
+            else
+                std::cout << (byte_code::toType(bl.back().type) == opInt? (float)res[i].val_i: res[i].val_f);
+            std::cout << (i < sizeof(res)/sizeof(res[0]) - 1? ", ": ";\n");
+        }
     }
     return err;
 }
@@ -18,15 +18,35 @@
 
 #include "stdio.h"
 #include "string.h"
+#include <map>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include "bnflite.h"
 #include "byte_code.h"
 
 using namespace bnf;
 
-static bool printErr(const char* lexem, size_t len)
+struct FormulaGrammar;
+typedef std::map<std::string, std::list<byte_code> > Frame;  // code of parameters of inlined function
+
+struct Compilation  // per parse context of callbacks, collects diagnostics instead of printing them
+{
+    const char* text;
+    std::vector<Diagnostic> diagnostics;
+    FormulaGrammar* grammar;
+    const std::vector<UserFunction>* library;   // functions to inline, only read while parsing
+    std::vector<Frame> frames; // nested inlined functions
+    int locals;                // local slots used for arguments of inlined functions
+    bool defining;             // parameters are not known until the definition is parsed
+    void Report(int status, const char* pos, std::string message)
+    {   Diagnostic d = { 0, status, (size_t)(pos - text), message }; diagnostics.push_back(d); }
+};
+
+static bool printErr(Compilation& comp, const char* lexem, size_t len)
 {
-    printf("strings are not supported yet: %.*s;\n", len, lexem);
+    comp.Report(eError, lexem, "strings are not supported yet: " + std::string(lexem, len));
     return false;
 }
 
@@ -44,7 +64,7 @@ Gen DoString(std::vector<Gen>& res)
 }
 
 
-Gen DoNumber(std::vector<Gen>& res)
+Gen DoNumber(std::vector<Gen>& res, Compilation& comp)
 {   /* use strtol/strtod to get value of parsed number */
     char* lst;
 	int j = res.size() - 1;
@@ -56,7 +76,7 @@ Gen DoNumber(std::vector<Gen>& res)
     if (lst - res[j].text - res[j].length == 0) {
 		return Gen(std::list<byte_code>(1, byte_code(opFloat, fvalue)), res);
 	}
-    std::cout << "number parse error:"; std::cout.write(res[0].text, res[0].length);
+    comp.Report(eError, res[0].text, "number parse error: " + std::string(res[0].text, res[j].text + res[j].length));
     return  Gen(std::list<byte_code>(1, byte_code(opError, 0)), res);
 
 }
@@ -78,75 +98,335 @@ Gen DoBinary(std::vector<Gen>& res)
     return Gen(left, res);
 }
 
-Gen DoFunction(std::vector<Gen>& res)
+Gen DoColumn(std::vector<Gen>& res)
+{   /* $ digits */
+    return Gen(GenColumnOp(atoi(res[0].text + 1)), res);
+}
+
+Gen DoLookup(std::vector<Gen>& res)
+{   /* LOOKUP ( table , index ) */
+    if (res.size() < 6)
+        return Gen(std::list<byte_code>(1, byte_code(opError, 0)), res);
+    return Gen(GenLookupOp(std::string(res[2].text, res[2].length), res[4].data), res);
+}
+
+Gen DoParameter(std::vector<Gen>& res, Compilation& comp)
+{   /* parameter of function definition */
+    std::string name(res[0].text, res[0].length);
+    Frame::iterator itr;
+    if (comp.defining && comp.frames.empty())
+        return Gen(std::list<byte_code>(1, byte_code(opFloat, 1.0f)), res);
+    if (comp.frames.size() && (itr = comp.frames.back().find(name)) != comp.frames.back().end())
+        return Gen(itr->second, res);
+    comp.Report(eError, res[0].text, "unknown name: " + name);
+    return Gen(std::list<byte_code>(1, byte_code(OP2(opFloat, opError), 0)), res);
+}
+
+static std::list<byte_code> Inline(const UserFunction& fun, std::vector< std::list<byte_code> >& args,
+    Compilation& comp, const char* pos);
+
+Gen DoFunction(std::vector<Gen>& res, Compilation& comp)
 {
     std::vector< std::list<byte_code> > args;
+    std::string name(res[0].text, res[0].length);
 
     for (unsigned int i = 1; i <  res.size(); i++) {
-        if( *res[i].text == '(' ||  *res[i].text == ',' ||  *res[i].text == ')' ) {
+        if (res[i].length == 1 && (*res[i].text == '(' ||  *res[i].text == ',' ||  *res[i].text == ')')) {
             continue;
         }
         args.push_back(res[i].data);
     }
-    return Gen(GenCallOp(std::string(res[0].text, res[0].length), args), res);
+    const std::vector<UserFunction>& library = *comp.library;
+    for (unsigned int i = 0; i < library.size(); i++) {
+        if (name == library[i].name && args.size() == library[i].params.size())
+            return Gen(Inline(library[i], args, comp, res[0].text), res);
+    }
+    return Gen(GenCallOp(name, args), res);
 }
 
+Gen DoDefinition(std::vector<Gen>& res, Compilation& comp);
 
-std::list<byte_code> bnflite_byte_code(std::string expr)
+
+struct FormulaGrammar    // built once and then only read, so it may be shared by parsing threads
 {
-    Token digit1_9('1', '9');
-    Token DIGIT("0123456789");
-    Lexem i_digit = 1*DIGIT;
-    Lexem frac_ = "." + i_digit;
-    Lexem int_ = "0" | digit1_9  + *DIGIT;
-    Lexem exp_ = "Ee" + !Token("+-") + i_digit;
-    Lexem number_ = !Token("-") + int_ + !frac_ + !exp_;
-    Rule number = number_;
+    Token digit1_9, DIGIT;
+    Lexem i_digit, frac_, int_, exp_, number_, column_;
+    Rule number, column;
+    Token az_, az01_, all;
+    Lexem identifier, quotedstring;
+    Rule expression, unary, function, lookup, parameter, elementary, primary, definition;
+
+    FormulaGrammar(): digit1_9('1', '9'), DIGIT("0123456789"), az_("_"), az01_("_"), all(1, 255)
+    {
+        i_digit = 1*DIGIT;
+        frac_ = "." + i_digit;
+        int_ = "0" | digit1_9  + *DIGIT;
+        exp_ = "Ee" + !Token("+-") + i_digit;
+        number_ = !Token("-") + int_ + !frac_ + !exp_;
+        number = number_;
+        column_ = "$" + i_digit;
+        column = column_;
 
-    Token az_("_"); az_.Add('A', 'Z'); az_.Add('a', 'z');
-    Token az01_(az_); az01_.Add('0', '9');
+        az_.Add('A', 'Z'); az_.Add('a', 'z');
+        az01_.Add('A', 'Z'); az01_.Add('a', 'z'); az01_.Add('0', '9');
+        all.Remove("\"");
 
-    Token all(1,255); all.Remove("\"");
+        identifier = az_  + *(az01_);
+        quotedstring = "\"" + *all + "\"";
 
-    Lexem identifier = az_  + *(az01_);
-    Lexem quotedstring = "\"" + *all + "\"";
+        function = identifier + "(" + !(expression + *("," + expression)) +  ")";
 
-    Rule expression;
-    Rule unary;
+        lookup = Lexem("LOOKUP") + "(" + identifier + "," + expression + ")";
 
-    Rule function = identifier + "(" + !(expression + *("," + expression)) +  ")";
+        parameter = identifier;
 
-    Rule elementary = AcceptFirst()
-            | "(" + expression + ")"
-            | function
-            | number
-            | quotedstring + printErr
-            | unary;
+        definition = Lexem("def") + identifier + "(" + !(identifier + *("," + identifier)) + ")" + "=" + expression;
 
-    unary = Token("-") + elementary;
+        elementary = AcceptFirst()
+                | "(" + expression + ")"
+                | lookup
+                | function
+                | number
+                | column
+                | parameter
+                | quotedstring + Action(printErr)
+                | unary;
 
-    Rule primary = elementary + *("*%/" + elementary);
+        unary = Token("-") + elementary;
+
+        primary = elementary + *("*%/" + elementary);
+
+        expression = primary + *("+-" + primary);
+
+        Bind(number, DoNumber);
+        Bind(elementary, DoBracket);
+        Bind(unary, DoUnary);
+        Bind(primary, DoBinary);
+        Bind(expression, DoBinary);
+        Bind(function, DoFunction);
+        Bind(lookup, DoLookup);
+        Bind(column, DoColumn);
+        Bind(parameter, DoParameter);
+        Bind(definition, DoDefinition);
+    }
+    ~FormulaGrammar()
+    {
+        expression = Null();  // disjoin Rule recursion to safe Rules removal
+        unary = Null();
+    }
+
+    int Compile(std::string expr, std::list<byte_code>& code, Compilation& comp,
+        const std::vector<UserFunction>& library)
+    {
+        const char* tail = 0;
+        Gen result;
+        comp.text = expr.c_str();
+        comp.diagnostics.clear();
+        comp.grammar = this;
+        comp.library = &library;
+        comp.frames.clear();
+        comp.locals = 0;
+        comp.defining = false;
+        int tst = Analyze(expression, expr.c_str(), &tail, result, &comp);
+        if (tst <= 0)
+            comp.Report(tst, tail, "parsing errors detected");
+        else if (comp.diagnostics.empty() && std::find_if(result.data.begin(), result.data.end(), IsError) != result.data.end())
+            comp.Report(eError, tail, "unknown function, table or wrong arguments");
+        if (tst > 0)
+            result.data = OptimizeBC(result.data);
+        code.swap(result.data);
+        return tst;
+    }
+    static bool IsError(const byte_code& bc)
+    {   return bc.type == OP2(opInt, opError) || bc.type == OP2(opFloat, opError); }
+};
+
+static FormulaGrammar& SharedGrammar()
+{
+    static FormulaGrammar grammar;
+    return grammar;
+}
+
+
+std::vector<UserFunction> GUserFunctions;
+static std::mutex GLibraryMutex;   // DefineFunction writes GUserFunctions, compiles read it
+
+static std::list<byte_code> Body(const UserFunction& fun, Frame& frame, Compilation& comp, const char* pos)
+{   /* parse body of the function with its parameters bound to the code of arguments */
+    std::list<byte_code> all;
+    if (comp.frames.size() >= 16) {
+        comp.Report(eError, pos, "too deep inlining of " + fun.name);
+        all.push_back(byte_code(OP2(opFloat, opError), 0));
+        return all;
+    }
+    const char* text = comp.text;
+    size_t reported = comp.diagnostics.size();
+    const char* tail = 0;
+    Gen body;
+    comp.frames.push_back(frame);
+    comp.text = fun.body.c_str();
+    int tst = Analyze(comp.grammar->expression, fun.body.c_str(), &tail, body, &comp);
+    comp.text = text;
+    comp.frames.pop_back();
+    for (size_t i = reported; i < comp.diagnostics.size(); i++) {
+        comp.diagnostics[i].offset = pos - text;    // diagnostics of body refer to the call
+        comp.diagnostics[i].message = "in " + fun.name + ": " + comp.diagnostics[i].message;
+    }
+    if (tst <= 0 || body.data.empty()) {
+        comp.Report(eError, pos, "bad body of " + fun.name);
+        body.data.assign(1, byte_code(OP2(opFloat, opError), 0));
+    } else if (comp.diagnostics.size() == reported
+            && std::find_if(body.data.begin(), body.data.end(), FormulaGrammar::IsError) != body.data.end()) {
+        comp.Report(eError, pos, "in " + fun.name + ": unknown function, table or wrong arguments");
+    }
+    return body.data;
+}
 
-    /* Rule */ expression = primary + *("+-" + primary);
+static std::list<byte_code> Inline(const UserFunction& fun, std::vector< std::list<byte_code> >& args,
+    Compilation& comp, const char* pos)
+{   /* arguments are computed once in order: constants and columns are substituted, others are kept in locals */
+    std::list<byte_code> all;
+    Frame frame;
+    for (unsigned int j = 0; j < args.size(); j++) {
+        if (args[j].empty())
+            continue;
+        int type = byte_code::toType(args[j].back().type);
+        if (args[j].size() == 1 && (args[j].back().type == opInt || args[j].back().type == opFloat
+                || args[j].back().type == OP2(opFloat, opColumn))) {
+            frame[fun.params[j]] = args[j];
+            continue;
+        }
+        if (comp.locals >= MAX_LOCAL_NUM) {
+            comp.Report(eError, pos, "too many arguments to keep for " + fun.name);
+            all.assign(1, byte_code(OP2(opFloat, opError), 0));
+            return all;
+        }
+        all.splice(all.end(), args[j]);
+        all.push_back(byte_code(OP2(type, opSet), comp.locals));
+        frame[fun.params[j]] = std::list<byte_code>(1, byte_code(OP2(type, opGet), comp.locals++));
+    }
+    all.splice(all.end(), Body(fun, frame, comp, pos));
+    return all;
+}
 
-    Bind(number, DoNumber);
-    Bind(elementary, DoBracket);
-    Bind(unary, DoUnary);
-    Bind(primary, DoBinary);
-    Bind(expression, DoBinary);
-    Bind(function, DoFunction);
+Gen DoDefinition(std::vector<Gen>& res, Compilation& comp)
+{   /* def NAME ( a , b ) = expression - checked by parsing with placeholders of parameters */
+    UserFunction fun;
+    fun.name = std::string(res[1].text, res[1].length);
+    fun.body = std::string(res.back().text, res.back().length);
+    if (IsBuiltIn(fun.name)) {
+        comp.Report(eError, res[1].text, "built-in function can not be redefined: " + fun.name);
+        return Gen(std::list<byte_code>(), res);
+    }
+    Frame frame;
+    for (unsigned int i = 3; i + 2 < res.size(); i += 2) {
+        if (res[i].length == 1 && *res[i].text == ')')
+            break;
+        fun.params.push_back(std::string(res[i].text, res[i].length));
+        frame[fun.params.back()] = std::list<byte_code>(1, byte_code(opFloat, 1.0f));
+    }
+    size_t reported = comp.diagnostics.size();
+    Body(fun, frame, comp, res[1].text);
+    if (comp.diagnostics.size() != reported)
+        return Gen(std::list<byte_code>(), res);
+    unsigned int i = 0;
+    while (i < GUserFunctions.size() && GUserFunctions[i].name != fun.name)
+        i++;
+    if (i == GUserFunctions.size()) {
+        GUserFunctions.push_back(fun);
+    } else if (GUserFunctions[i].params != fun.params || GUserFunctions[i].body != fun.body) {
+        comp.Report(eError, res[1].text, "function is defined already: " + fun.name);
+        return Gen(std::list<byte_code>(), res);
+    }
+    return Gen(std::list<byte_code>(1, byte_code(opInt, (int)i)), res);
+}
 
+int DefineFunction(std::string def, std::vector<Diagnostic>* diagnostics)
+{
+    Compilation comp;
     const char* tail = 0;
     Gen result;
+    comp.text = def.c_str();
+    comp.grammar = &SharedGrammar();
+    comp.library = &GUserFunctions;
+    comp.locals = 0;
+    comp.defining = true;
+    std::lock_guard<std::mutex> lock(GLibraryMutex);
+    int tst = Analyze(comp.grammar->definition, def.c_str(), &tail, result, &comp);
+    if (tst <= 0)
+        comp.Report(tst, tail, "bad definition");
+    int index = comp.diagnostics.empty() && result.data.size()? result.data.front().val_i : -1;
+    if (diagnostics)
+        diagnostics->swap(comp.diagnostics);
+    return index;
+}
 
-    int tst = Analyze(expression, expr.c_str(), &tail, result);
+std::list<byte_code> bnflite_byte_code(std::string expr)
+{
+    std::list<byte_code> code;
+    Compilation comp;
+    int tst;
+    {
+        std::lock_guard<std::mutex> lock(GLibraryMutex);
+        tst = SharedGrammar().Compile(expr, code, comp, GUserFunctions);
+    }
+    for (size_t i = 0; i + (tst <= 0) < comp.diagnostics.size(); i++)
+        std::cout << comp.diagnostics[i].message << std::endl;
     if (tst > 0)
-        std::cout << result.data.size() << " byte-codes in: " << expr << std::endl;
+        std::cout << code.size() << " byte-codes in: " << expr << std::endl;
     else
         std::cout << "Parsing errors detected, status = " << std::hex << tst << std::endl
-         << "stopped at: " << tail << std::endl;
+         << "stopped at: " << expr.c_str() + comp.diagnostics.back().offset << std::endl;
+    return code;
+}
+
+int bnflite_bulk_compile(const std::vector<std::string>& formulas, BulkProgram& bulk, unsigned int threads)
+{
+    std::map<std::string, int> unique;
+    std::vector<const std::string*> sources;
+    bulk.program_of.resize(formulas.size());
+    for (size_t i = 0; i < formulas.size(); i++) {
+        std::pair<std::map<std::string, int>::iterator, bool> ins =
+            unique.insert(std::make_pair(formulas[i], (int)sources.size()));
+        if (ins.second)
+            sources.push_back(&ins.first->first);
+        bulk.program_of[i] = ins.first->second;
+    }
+    bulk.programs.assign(sources.size(), std::list<byte_code>());
+    std::vector<std::vector<Diagnostic> > diagnostics(sources.size());
+    std::vector<int> status(sources.size());
 
-    expression = Null();  // disjoin Rule recursion to safe Rules removal
-    unary = Null();
-    return result.data;
+    FormulaGrammar& grammar = SharedGrammar();
+    std::vector<UserFunction> library;  // workers read the snapshot, DefineFunction may run meanwhile
+    {
+        std::lock_guard<std::mutex> lock(GLibraryMutex);
+        library = GUserFunctions;
+    }
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        Compilation comp;
+        for (size_t u; (u = next++) < sources.size(); ) {
+            status[u] = grammar.Compile(*sources[u], bulk.programs[u], comp, library);
+            diagnostics[u].swap(comp.diagnostics);
+        }
+    };
+    if (!threads)
+        threads = std::thread::hardware_concurrency();
+    std::vector<std::thread> pool;
+    for (unsigned int t = 1; t < threads && t < sources.size(); t++)
+        pool.push_back(std::thread(work));
+    work();
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+
+    int failed = 0;
+    bulk.diagnostics.clear();
+    for (size_t u = 0; u < sources.size(); u++) {
+        failed += !diagnostics[u].empty();
+        for (size_t k = 0; k < diagnostics[u].size(); k++) {
+            diagnostics[u][k].program = u;
+            bulk.diagnostics.push_back(diagnostics[u][k]);
+        }
+    }
+    return failed;
 }
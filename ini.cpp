@@ -39,7 +39,7 @@ struct Section
      vector< pair< string, string> > value;
      Section(const char* name, size_t len) :name(name, len) {}
 };
-vector <struct Section> Ini;  // ini-file configuration container 
+typedef vector <struct Section> Config;  // ini-file configuration container, parsing context
 
 // example for custom interface instead of "typedef Interface<int> Gen;"
 class Gen :public  Interface<>
@@ -62,13 +62,13 @@ static bool printMsg(const char* lexem, size_t len)
 }
 
 
-Gen DoSection(vector<Gen>& res)
+Gen DoSection(vector<Gen>& res, Config& Ini)
 {   // save new section, it is 2nd lexem in section Rule in main
     Ini.push_back(Section(res[1].text, res[1].length));
     return Gen(res.front(), res.back());
 }
 
-Gen DoValue(vector<Gen>& res)
+Gen DoValue(vector<Gen>& res, Config& Ini)
 {   // save new entry: 4th lexem - name and 7th lexem is property value
    int i = res.size();
    if (i > 2 )
@@ -124,8 +124,9 @@ int main()
     Bind(Section, Item);
 
     const char* tail = "";
+    Config Ini;
     ini_parser myParser;
-
+    myParser.Set_context(&Ini);
 
     int tst = Analyze(Inidata, ini, myParser);
     myParser.Get_tail(&tail);